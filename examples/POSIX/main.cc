@@ -127,6 +127,22 @@ int main( int argc, char* argv[] )
         goto shutdown;
     }
 
+#if defined(__linux__)
+    // For deterministic I/O timing, e.g. on a PREEMPT_RT kernel, set
+    // CIPSTER_RT_PRIORITY to a SCHED_FIFO priority, and optionally
+    // CIPSTER_RT_CPU to the CPU to run the I/O on.
+    if( getenv( "CIPSTER_RT_PRIORITY" ) )
+    {
+        const char* cpu = getenv( "CIPSTER_RT_CPU" );
+
+        if( NetworkHandlerRealTime( atoi( getenv( "CIPSTER_RT_PRIORITY" ) ),
+                cpu ? atoi( cpu ) : -1 ) != kEipStatusOk )
+        {
+            fprintf( stderr, "Unable to fully enter real time execution\n" );
+        }
+    }
+#endif
+
 #ifndef _WIN32
     // register for closing signals so that we can trigger the stack to end
     signal( SIGHUP, LeaveStack );
@@ -135,15 +151,34 @@ int main( int argc, char* argv[] )
 
     printf( "running...\n" );
 
-    // The event loop. Put other processing you need done continually in here
+    // The event loop. Put other processing you need done continually in here.
+    // The stack sleeps until a socket is ready or its next timer is due, but
+    // no longer than this.  A signal also ends the wait.
     while( !g_end_stack )
     {
-        if( kEipStatusOk != NetworkHandlerProcessOnce() )
+        if( kEipStatusOk != NetworkHandlerProcessOnce( 1000000 ) )
         {
             break;
         }
     }
 
+#if defined(__linux__)
+    if( getenv( "CIPSTER_RT_PRIORITY" ) )
+    {
+        RealTimeStats stats;
+
+        NetworkHandlerRealTimeStats( &stats );
+
+        printf( "\n%llu I/O passes suffered %llu minor and %llu major page faults,"
+                " %llu voluntary and %llu involuntary context switches\n",
+            (unsigned long long) stats.passes,
+            (unsigned long long) stats.minor_faults,
+            (unsigned long long) stats.major_faults,
+            (unsigned long long) stats.voluntary_switches,
+            (unsigned long long) stats.involuntary_switches );
+    }
+#endif
+
     printf( "\ncleaning up and ending...\n" );
 
     // clean up network state
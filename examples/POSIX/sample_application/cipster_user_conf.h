@@ -78,9 +78,8 @@
 
 /**
  *  The number of bytes used for the buffer that will be used for generating any
- *  reply data of messages. There are two uses in CIPster:
- *    1. Explicit messages will use this buffer to store the data generated by the request
- *    2. I/O Connections will use this buffer for the produced data
+ *  reply data of messages.  Explicit messages will use this buffer to store
+ *  the data generated by the request.
  */
 #define CIPSTER_MESSAGE_DATA_REPLY_BUFFER    1600
 
@@ -89,6 +88,57 @@
  */
 #define CIPSTER_NUMBER_OF_SUPPORTED_SESSIONS 20
 
+/**
+ * Number of CIPSTER_ETHERNET_BUFFER_SIZE message buffers, one for each open
+ * TCP connection, three for the encapsulation UDP sockets, and one for I/O
+ * receive where recvmmsg() is not available.  Defaults to
+ * CIPSTER_NUMBER_OF_SUPPORTED_SESSIONS + 4.
+ */
+//#define CIPSTER_NUM_MESSAGE_BUFFERS   (CIPSTER_NUMBER_OF_SUPPORTED_SESSIONS + 4)
+
+/**
+ * Unsent TCP reply bytes are queued per connection and sent as the client
+ * takes them.  A connection whose queue holds this many bytes is not read
+ * from until it drains below this.  Defaults to 2 * CIPSTER_ETHERNET_BUFFER_SIZE.
+ */
+//#define CIPSTER_TCP_TX_HIGH_WATER     (2 * CIPSTER_ETHERNET_BUFFER_SIZE)
+
+/**
+ * On Linux the network handler uses epoll to find the ready sockets.
+ * Define this to use the portable select() based code instead.
+ */
+//#define CIPSTER_USE_SELECT
+
+/**
+ * Define this to have the I/O connections served by a thread of their own,
+ * started by NetworkHandlerInitialize(), so that a slow explicit message
+ * cannot delay their production or consumption.  Then HandleApplication()
+ * and the assembly callbacks are called on that thread.  Needs epoll, so
+ * Linux without CIPSTER_USE_SELECT, and linking with pthreads.
+ */
+//#define CIPSTER_WITH_IO_THREAD
+
+/**
+ * Define this to the count of threads which perform the services marked as
+ * thread safe with CipService::SetThreadSafe(), so a slow one on one session
+ * does not hold up the others.  Each session still gets its replies in order,
+ * its next request waits for the worker.  Needs epoll and pthreads too.
+ * None of the stack's own services is so marked, since each touches state the
+ * network handler also does, so this only offloads the application's classes
+ * which opt in, and does nothing without them.
+ */
+//#define CIPSTER_MR_WORKERS            4
+
+/**
+ * Define this to have producing I/O connections send their assembly data
+ * straight from the application's assembly storage, gathered after the frame
+ * header by sendmsg(), rather than copied into the connection's frame first.
+ * Then on Linux an assembly must not be changed between its
+ * BeforeAssemblyDataSend() call and the end of that ManageConnections() pass,
+ * when the tick's frames are actually sent.
+ */
+//#define CIPSTER_ZERO_COPY_IO_TX
+
 /**
  * The clock period in usecs of the timer used in this implementation.
  * It should be a multiple of milliseconds expressed in microseconds,
@@ -100,6 +150,30 @@
  */
 const unsigned kCIPsterTimerTickInMicroSeconds = 10000;
 
+/**
+ * The granularity in usecs of the RPIs granted to I/O connections, and the
+ * smallest RPI.  Connections run on their own deadlines, not on the tick
+ * above, so this may be much smaller.  Defaults to the tick.
+ */
+//#define CIPSTER_RPI_RESOLUTION_USECS  250
+
+/**
+ * What a cyclic connection does after a stall left it more than one RPI late:
+ * CIPSTER_LATE_CATCH_UP sends a frame for each RPI missed, back to back,
+ * CIPSTER_LATE_SKIP sends one and keeps its phase, CIPSTER_LATE_REPHASE
+ * sends one and starts its RPI over from then.  Defaults to catching up.
+ */
+//#define CIPSTER_LATE_PRODUCTION       CIPSTER_LATE_SKIP
+
+/**
+ * Non-zero gives each cyclic connection its first production in the least
+ * loaded slot of CIPSTER_RPI_RESOLUTION_USECS within its RPI, so that those
+ * opened together do not all produce on the same tick.  This delays the first
+ * frame of a newly opened connection by up to one RPI.
+ * Defaults to zero, which has each produce on the next tick after it is opened.
+ */
+//#define CIPSTER_STAGGER_PRODUCTION    1
+
 /**
  * The setting of this affects the real time format of
  * the consuming half of a kConnTransportClass0 or kConnTransportClass1
@@ -77,9 +77,8 @@
 
 /**
  *  The number of bytes used for the buffer that will be used for generating any
- *  reply data of messages. There are two uses in CIPster:
- *    1. Explicit messages will use this buffer to store the data generated by the request
- *    2. I/O Connections will use this buffer for the produced data
+ *  reply data of messages.  Explicit messages will use this buffer to store
+ *  the data generated by the request.
  */
 #define CIPSTER_MESSAGE_DATA_REPLY_BUFFER    1600
 
@@ -99,6 +98,15 @@
  */
 const unsigned kCIPsterTimerTickInMicroSeconds = 10000;
 
+/**
+ * Non-zero gives each cyclic connection its first production in the least
+ * loaded slot of CIPSTER_RPI_RESOLUTION_USECS within its RPI, so that those
+ * opened together do not all produce on the same tick.  This delays the first
+ * frame of a newly opened connection by up to one RPI.
+ * Defaults to zero, which has each produce on the next tick after it is opened.
+ */
+//#define CIPSTER_STAGGER_PRODUCTION    1
+
 /**
  * The setting of this affects the real time format of
  * the consuming half of a kConnTransportClass0 or kConnTransportClass1
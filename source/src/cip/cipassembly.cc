@@ -9,6 +9,7 @@
 #include "cipassembly.h"
 
 #include <cipster_api.h>
+#include <triple_buf.h>
 #include "cipconnectionmanager.h"
 
 #undef  INSTANCE_CLASS
@@ -21,11 +22,97 @@ AssemblyInstance::AssemblyInstance( int aInstanceId, ByteBuf aBuffer ) :
     // The assembly's ByteBuf spans the full application-owned allocation, so its size
     // is the true capacity (capacity == length for a fixed assembly buffer).
     byte_array( aBuffer.data(), (uint16_t) aBuffer.size() ),
-    connection_point_roles( kRoleNone )
+    connection_point_roles( kRoleNone ),
+    in_place_consumer( NULL ),
+    triple( NULL ),
+    refreshed_usecs( 0 )
 {
 }
 
 
+AssemblyInstance::~AssemblyInstance()
+{
+    delete triple;
+}
+
+
+void AssemblyInstance::SetTripleBuffered()
+{
+    if( triple || !byte_array.size() )
+        return;
+
+    triple = new TripleBuf( byte_array.data(), byte_array.capacity() );
+
+    // The stack's image until the first Refresh() or store().  Front() is
+    // only ever the reader's, so a PublishImage() before the first Refresh()
+    // cannot hand it to the application to write.  A consumed assembly's
+    // reader only gets it after store() has moved the stack off it.
+    byte_array = CipByteArray( triple->Front(), triple->Size(),
+                    byte_array.length() );
+
+    refreshed_usecs = g_current_usecs - 1;
+}
+
+
+uint8_t* AssemblyInstance::ImageToWrite()
+{
+    CIPSTER_ASSERT( triple );
+    return triple->Back();
+}
+
+
+void AssemblyInstance::PublishImage()
+{
+    CIPSTER_ASSERT( triple );
+    triple->Publish();
+}
+
+
+BufReader AssemblyInstance::LatestImage()
+{
+    CIPSTER_ASSERT( triple );
+    triple->Acquire();
+    return BufReader( triple->Front(), byte_array.length() );
+}
+
+
+void AssemblyInstance::Refresh()
+{
+    // Only the application writes a produced assembly, the stack reads it.
+    if( !triple || !HasConnectionPointRole( kRoleProduced ) )
+        return;
+
+    // Once per tick, so that a datagram held for the tick's batch by
+    // CIPSTER_ZERO_COPY_IO_TX still points at an image no one writes.
+    if( refreshed_usecs == g_current_usecs )
+        return;
+
+    refreshed_usecs = g_current_usecs;
+
+    triple->Acquire();
+
+    byte_array = CipByteArray( triple->Front(), triple->Size(),
+                    byte_array.length() );
+}
+
+
+void AssemblyInstance::store( const BufReader& aInput )
+{
+    if( !triple )
+    {
+        memcpy( byte_array.data(), aInput.data(), aInput.size() );
+        return;
+    }
+
+    memcpy( triple->Back(), aInput.data(), aInput.size() );
+    triple->Publish();
+
+    // Reading what was just published is safe, the stack is its only writer.
+    byte_array = CipByteArray( triple->Published(), triple->Size(),
+                    byte_array.length() );
+}
+
+
 EipStatus AssemblyInstance::RecvData( CipConn* aConn, BufReader aBuffer )
 {
     if( ( aConn->ConsumingNCP().IsFixed() && SizeBytes() != aBuffer.size()) ||
@@ -37,7 +124,10 @@ EipStatus AssemblyInstance::RecvData( CipConn* aConn, BufReader aBuffer )
         return kEipStatusError;
     }
 
-    memcpy( Buffer().data(), aBuffer.data(), aBuffer.size() );
+    if( in_place_consumer )
+        return in_place_consumer( this, aConn, aBuffer );
+
+    store( aBuffer );
 
     // notify application that new data arrived
     return AfterAssemblyDataReceived( this, aConn->Mode(), aBuffer.size() );
@@ -115,6 +205,8 @@ EipStatus CipAssemblyClass::get_assembly_data_attr( CipInstance* aInstance, CipA
     {
         BeforeAssemblyDataSend( assembly );
 
+        assembly->Refresh();
+
         return CipAttribute::GetAttrData( assembly, attr, request, response );
     }
 
@@ -161,8 +253,8 @@ EipStatus CipAssemblyClass::set_assembly_data_attr( CipInstance* aInstance, CipA
             assembly->Id()
             );
 
-        memcpy( assembly->byte_array.data(), request->Data().data(),
-                assembly->byte_array.size() );
+        assembly->store( BufReader( request->Data().data(),
+                assembly->byte_array.size() ) );
 
         if( AfterAssemblyDataReceived( assembly,
                 kOpModeUnknown, request->Data().size() ) != kEipStatusOk )
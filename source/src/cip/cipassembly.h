@@ -10,6 +10,8 @@
 #include "ciptypes.h"
 #include "cipclass.h"
 
+class CipConn;
+class TripleBuf;
 
 /**
  * Class AssemblyInstance
@@ -30,14 +32,70 @@ public:
         kRoleConfiguration = 4     ///< Configuration Assembly
     };
 
+    /**
+     * Typedef InPlaceConsumer
+     * is an application function which takes an assembly's consumed I/O
+     * data where it lies in the receive buffer, given to SetInPlaceConsumer().
+     *
+     * @param aInstance is the assembly the data is for.
+     * @param aConn is the connection it came in on, use its Mode() for the
+     *  run/idle state.
+     * @param aInput is the data, which the size check in RecvData() has
+     *  passed.  It is only valid for the duration of the call.
+     * @return EipStatus - as for AfterAssemblyDataReceived()
+     */
+    typedef EipStatus (*InPlaceConsumer)( AssemblyInstance* aInstance,
+                CipConn* aConn, BufReader aInput );
+
     AssemblyInstance( int aInstanceId, ByteBuf aBuf );
 
+    ~AssemblyInstance();
+
     unsigned SizeBytes() const      { return byte_array.size(); }
 
     /// Return a ByteBuf view spanning the assembly's valid bytes.  Returned by value
     /// (not a reference to the member) because the member is now a CipByteArray.
+    /// When triple buffered, this is the stack's image, see SetTripleBuffered().
     ByteBuf Buffer() const          { return ByteBuf( byte_array.data(), byte_array.length() ); }
 
+    /**
+     * Function SetTripleBuffered
+     * gives this assembly three images of its bytes, each starting as a copy
+     * of the buffer given to CreateAssemblyInstance(), which the stack then
+     * no longer uses.  An application thread may then write a produced
+     * assembly, or read a consumed one, without locks and without racing
+     * the stack: it fills ImageToWrite() and calls PublishImage(), or reads
+     * LatestImage().  The stack always sends, or stores into, a complete
+     * image of its own.  Each connection producing the assembly in the same
+     * tick sends the same image.  Not for a configuration assembly, nor for
+     * one with no bytes.  Call it before any connection to the assembly opens.
+     */
+    void SetTripleBuffered();
+
+    bool IsTripleBuffered() const   { return triple != NULL; }
+
+    /**
+     * Function ImageToWrite
+     * returns where the application thread fills the next image of this
+     * produced assembly, which the stack does not see until PublishImage().
+     */
+    uint8_t* ImageToWrite();
+
+    /**
+     * Function PublishImage
+     * makes the image filled at ImageToWrite() the one the stack sends next.
+     * Only the application thread writing this assembly may call it.
+     */
+    void PublishImage();
+
+    /**
+     * Function LatestImage
+     * returns the newest complete image the stack has stored into this
+     * consumed assembly, which stays put until the next call.  Only the
+     * application thread reading this assembly may call it.
+     */
+    BufReader LatestImage();
+
     void AddConnectionPointRole( ConnectionPointRole aRole )
     {
         connection_point_roles |= aRole;
@@ -48,12 +106,26 @@ public:
         return 0 != ( connection_point_roles & aRole );
     }
 
+    /**
+     * Function SetInPlaceConsumer
+     * opts this assembly out of having its consumed data copied into it.
+     * RecvData() instead hands the data to @a aConsumer where it lies in the
+     * receive buffer, and AfterAssemblyDataReceived() is not called for it.
+     * The assembly's own bytes, as read by attribute 3, are then only what
+     * the application puts there.  Pass NULL to go back to copying.
+     */
+    void SetInPlaceConsumer( InPlaceConsumer aConsumer )
+    {
+        in_place_consumer = aConsumer;
+    }
+
     /**
      * Function RecvData
      * notifies an AssemblyInstance that data has been received for it.
      *
      * The data will be copied into the assembly instance's attribute 3 and
-     * the application will be informed with the AfterAssemblyDataReceived() function.
+     * the application will be informed with the AfterAssemblyDataReceived() function,
+     * unless an InPlaceConsumer has been set.
      *
      * @param aConn which connection did the io connection datagram come in on?
      *  It has the scanner specific Header32Bit info in it.
@@ -65,9 +137,24 @@ public:
      */
     EipStatus RecvData( CipConn* aConn, BufReader aInput );
 
+    /**
+     * Function Refresh
+     * points Buffer() at the newest image the application has published,
+     * at most once per tick, when triple buffered.  Called before the stack
+     * reads a produced assembly.
+     */
+    void Refresh();
+
 protected:
+    /// Store @a aInput as the assembly's bytes, publishing it if triple buffered.
+    void store( const BufReader& aInput );
+
     CipByteArray    byte_array;
     unsigned        connection_point_roles;
+    InPlaceConsumer in_place_consumer;
+
+    TripleBuf*      triple;             // NULL unless SetTripleBuffered()
+    uint64_t        refreshed_usecs;    // g_current_usecs at last Refresh()
 };
 
 
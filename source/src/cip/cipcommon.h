@@ -10,10 +10,15 @@
  * Common CIP object interface
  */
 
+#include <cipster_user_conf.h>
 #include <typedefs.h>
 #include "ciptypes.h"
 #include <byte_bufs.h>
 
+#if defined(CIPSTER_WITH_IO_THREAD)
+ #include <atomic>
+#endif
+
 
 /// Binary search function template, dedicated for classes with Id() member func
 template< typename T, typename IterT >
@@ -68,11 +73,10 @@ std::string StrPrintf( const char* aFormat, ... );
 const char* CipVendorStr( int aVendorId );
 
 
-/** A buffer for holding the reply generated by explicit message requests
- *  or producing I/O connections. These will use this buffer in the following
- *  ways:
- *    1. Explicit messages will use this buffer to store the data generated by the request
- *    2. I/O Connections will use this buffer for the produced data
+/** A buffer for holding the reply generated by explicit message requests.
+ *  Explicit messages will use this buffer to store the data generated by the
+ *  request.  Producing I/O connections build their frames in their own
+ *  CipConn::tx_frame instead.
  */
 extern uint8_t g_message_data_reply_buffer[CIPSTER_MESSAGE_DATA_REPLY_BUFFER];
 
@@ -80,7 +84,12 @@ extern uint8_t g_message_data_reply_buffer[CIPSTER_MESSAGE_DATA_REPLY_BUFFER];
 /// messages on other than the standard port number.
 extern int g_my_io_udp_port;
 
+#if defined(CIPSTER_WITH_IO_THREAD)
+/// Advanced by the I/O thread, read by both it and the explicit thread.
+extern std::atomic<uint64_t> g_current_usecs;
+#else
 extern uint64_t g_current_usecs;
+#endif
 
 /// The run/idle mode sent when our producing half is kRealTimeFmt32BitHeader,
 /// which is likely only when we are acting as a scanner.
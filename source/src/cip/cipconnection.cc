@@ -1089,8 +1089,16 @@ CipConn::CipConn() :
     instance_id( ++constructed_count ),
     next(NULL),
     prev(NULL),
-    on_list(false)
+    on_list(false),
+    timer_index(kTimerNone),
+    timer_key(0),
+    cid_next(NULL)
 {
+    tx_eip_seq_at   = 0;
+    tx_seq_at       = 0;
+    tx_run_idle_at  = 0;
+    tx_data_at      = 0;
+
     Clear( false );
 }
 
@@ -1130,14 +1138,29 @@ void CipConn::Clear( bool doConnectionDataToo )
 
     encap_session = 0;
 
+    class3_reply.clear();
+    class3_reply_seq = 0;
+    class3_reply_valid = false;
+
     next = NULL;
     prev = NULL;
     on_list = false;
+    timer_index = kTimerNone;
+    cid_next = NULL;
+
+    tx_frame.clear();
+    tx_data_at = 0;
 
     expected_packet_rate_usecs = 0;
 }
 
 
+void CipConn::requeueTimers()
+{
+    g_active_conns.QueueTimers( this );
+}
+
+
 const char* CipConn::ShowState( ConnState aState )
 {
     static char unknown[16];
@@ -1264,6 +1287,10 @@ void CipConn::GeneralConfiguration( ConnectionData* aConnData, ConnInstanceType
     eip_level_sequence_count_consuming = 0;
     eip_level_sequence_count_consuming_first = true;
 
+    class3_reply_valid = false;
+
+    rx_timing.Clear();
+
     sequence_count_consuming = 0;
 
     watchdog_timeout_action = kWatchdogTimeoutActionAutoDelete;
@@ -1279,10 +1306,9 @@ void CipConn::GeneralConfiguration( ConnectionData* aConnData, ConnInstanceType
     // Server Type Connection requested
     SetExpectedPacketRateUSecs( consuming_RPI_usecs );
 
+    // The PIT stays as given, or defaulted, in the forward open's path.
     SetProductionInhibitTimerUSecs( 0 );
 
-    SetPIT_USecs( 0 );
-
     // Vol1 3-4.5.2, says to set *initial* value to greater of 10 seconds or
     // "expected_packet_rate x connection_timeout_multiplier".  Initial value
     // is called a "pre-consumption" timeout value.
@@ -1406,7 +1432,28 @@ CipError CipConn::Activate( Cpf* aCpf, ConnMgrStatus* aExtError )
         return result;
     }
 
+    if( producing_instance )
+        buildTxFrame();
+
+#if CIPSTER_STAGGER_PRODUCTION
+    bool staggered = ProducesOnTimer() && trigger.Trigger() == kConnTriggerTypeCyclic;
+
+    if( staggered )
+        CipConnMgrClass::StaggerProduction( this );
+#endif
+
     g_active_conns.Insert( this );
+
+#if CIPSTER_STAGGER_PRODUCTION && defined(CIPSTER_WITH_TRACES)
+    if( staggered )
+    {
+        std::vector<int> load;
+        int worst = CipConnMgrClass::ProductionSlotLoad( &load );
+
+        CIPSTER_TRACE_INFO( "%s<%d>: at most %d cyclic productions in any of %u slots\n",
+            __func__, instance_id, worst, unsigned( load.size() ) );
+    }
+#endif
     SetState( kConnStateEstablished );
 
     NotifyIoConnectionEvent( this, kIoConnectionEventOpened );
@@ -1415,20 +1462,83 @@ CipError CipConn::Activate( Cpf* aCpf, ConnMgrStatus* aExtError )
 }
 
 
-EipStatus CipConn::SendConnectedData()
+void CipConn::buildTxFrame()
 {
-    /*
-        TODO think of adding an own send buffer to each connection object in
-        order to pre-setup the whole message on connection opening and just
-        change the variable data items e.g., sequence number
-    */
+    AssemblyInstance* assembly = static_cast<AssemblyInstance*>( producing_instance );
+
+    ByteBuf attr3 = assembly->Buffer();
+
+    // Use Sequenced Address Item if not Connection Class 0
+    bool sequenced = trigger.Class() != kConnTransportClass0;
+
+    Cpf cpfd(
+        AddressItem(
+            sequenced ? kCpfIdSequencedAddress : kCpfIdConnectedAddress,
+            producing_connection_id,
+            0 ),
+        kCpfIdConnectedDataItem
+        );
+
+    // Room for the largest header: 18 bytes of CPF, the class 1 sequence
+    // count and the 32 bit run/idle header.
+    tx_frame.resize( 24 + attr3.size() );
+
+    uint8_t*    frame = &tx_frame[0];
+    BufWriter   out( frame, tx_frame.size() );
+
+    int length = cpfd.Serialize( out );
+
+    // item_count, type_id, length and connection_identifier precede it.
+    tx_eip_seq_at = sequenced ? 10 : 0;
+
+    // Advance over Cpf serialization, which ended after data_item.length, but
+    // prepare to re-write that 16 bit field below, ergo -2
+    out += (length - 2);
+
+    int data_len = attr3.size();
+
+    bool run_idle = producing_fmt == kRealTimeFmt32BitHeader && data_len;
+
+    if( run_idle )
+    {
+        data_len += 4;
+    }
+
+    tx_seq_at = 0;
+
+    if( trigger.Class() == kConnTransportClass1 )
+    {
+        data_len += 2;
+
+        out.put16( data_len );
+        tx_seq_at = out.data() - frame;
+        out.put16( 0 );
+    }
+    else
+    {
+        out.put16( data_len );
+    }
+
+    tx_run_idle_at = 0;
+
+    if( run_idle )
+    {
+        tx_run_idle_at = out.data() - frame;
+        out.put32( 0 );
+    }
+
+    tx_data_at = out.data() - frame;
+
+    tx_frame.resize( tx_data_at + attr3.size() );
+}
 
+
+EipStatus CipConn::SendConnectedData()
+{
     AssemblyInstance* assembly = static_cast<AssemblyInstance*>( producing_instance );
 
     EipStatus result = kEipStatusOk;
 
-    BufWriter out( g_message_data_reply_buffer, sizeof g_message_data_reply_buffer );
-
     /*
         For class 0 and class 1 connections over EtherNet/IP, devices shall
         maintain an Encapsulation Sequence Number in the UDP payload defined in
@@ -1443,18 +1553,6 @@ EipStatus CipConn::SendConnectedData()
     */
     ++eip_level_sequence_count_producing;
 
-    //----<AddressInfoItem>-----------------------------------------------------
-
-    Cpf cpfd(
-        AddressItem(
-            // use Sequenced Address Item if not Connection Class 0
-            trigger.Class() == kConnTransportClass0 ?
-                kCpfIdConnectedAddress : kCpfIdSequencedAddress,
-            producing_connection_id,
-            eip_level_sequence_count_producing ),
-        kCpfIdConnectedDataItem
-        );
-
     // Notify the application that Assembly data pertinent to provided instance
     // will be sent immediately after the call.  If application returns true,
     // this means the Assembly data has changed or should be reported as
@@ -1468,43 +1566,33 @@ EipStatus CipConn::SendConnectedData()
         ++sequence_count_producing;
     }
 
-    //----<DataInfoItem>--------------------------------------------------------
+    assembly->Refresh();
 
     ByteBuf attr3 = assembly->Buffer();
 
-    int length = cpfd.Serialize( out );
+    // Built by Activate(), but a hand off of the producing socket in Close()
+    // can make this connection the producer without it.
+    if( !tx_data_at || tx_frame.size() != size_t( tx_data_at + attr3.size() ) )
+        buildTxFrame();
 
-    // Advance over Cpf serialization, which ended after data_item.length, but
-    // prepare to re-write that 16 bit field below, ergo -2
-    out += (length - 2);
-
-    int data_len = attr3.size();
+    uint8_t* frame = &tx_frame[0];
 
-    if( producing_fmt == kRealTimeFmt32BitHeader && data_len )
-    {
-        data_len += 4;
-    }
+    if( tx_eip_seq_at )
+        BufWriter( frame + tx_eip_seq_at, 4 ).put32( eip_level_sequence_count_producing );
 
-    if( trigger.Class() == kConnTransportClass1 )
-    {
-        data_len += 2;
+    if( tx_seq_at )
+        BufWriter( frame + tx_seq_at, 2 ).put16( sequence_count_producing );
 
-        out.put16( data_len );
-        out.put16( sequence_count_producing );
-    }
-    else
-    {
-        out.put16( data_len );
-    }
+    if( tx_run_idle_at )
+        BufWriter( frame + tx_run_idle_at, 4 ).put32( g_run_idle_state );
 
-    if( producing_fmt == kRealTimeFmt32BitHeader && data_len )
-    {
-        out.put32( g_run_idle_state );
-    }
+#if !defined(CIPSTER_ZERO_COPY_IO_TX)
+    memcpy( frame + tx_data_at, attr3.data(), attr3.size() );
+#endif
 
-    out.append( attr3 );
+    int length = tx_frame.size();
 
-    length += data_len;
+    (void) length;      // when traces are off and CIPSTER_ZERO_COPY_IO_TX
 
     CIPSTER_TRACE_INFO(
         "%s[%d]@%u PID:0x%08x len:%-3d dst:%s:%d\n",
@@ -1520,9 +1608,13 @@ EipStatus CipConn::SendConnectedData()
     // send out onto UDP wire
     try
     {
+#if defined(CIPSTER_ZERO_COPY_IO_TX)
+        // the assembly data goes straight from the application's storage
         ProducingUdp()->Send( send_address,
-                BufReader( g_message_data_reply_buffer, length )
-                );
+                BufReader( frame, tx_data_at ), attr3 );
+#else
+        ProducingUdp()->Send( send_address, BufReader( frame, length ) );
+#endif
     }
     catch( const socket_error& se )
     {
@@ -1601,10 +1693,36 @@ EipStatus CipConn::HandleReceivedIoConnectionData( BufReader aInput )
 }
 
 
+void RxTiming::Note( const RxStamp& aStamp, uint32_t aRpiUSecs )
+{
+    if( frames++ )
+    {
+        uint32_t gap = uint32_t( aStamp.arrived_usecs - last_arrived_usecs );
+        uint32_t dev = gap > aRpiUSecs ? gap - aRpiUSecs : aRpiUSecs - gap;
+
+        max_gap_usecs     = std::max( max_gap_usecs, gap );
+        max_rpi_dev_usecs = std::max( max_rpi_dev_usecs, dev );
+        sum_rpi_dev_usecs += dev;
+
+        // RFC 3550 A.8, J += ( |D| - J ) / 16, kept times 16.
+        jitter_x16 += dev - ( ( jitter_x16 + 8 ) >> 4 );
+    }
+
+    max_queued_usecs   = std::max( max_queued_usecs, aStamp.queued_usecs );
+    last_arrived_usecs = aStamp.arrived_usecs;
+}
+
+
 void CipConn::timeOut()
 {
     if( IsIOConnection() )
     {
+        CIPSTER_TRACE_WARN( "%s<%d>: %u frames, gaps max:%u  RPI deviation"
+            " max:%u mean:%u  jitter:%u  queued max:%u usecs\n",
+            __func__, instance_id, rx_timing.frames, rx_timing.max_gap_usecs,
+            rx_timing.max_rpi_dev_usecs, rx_timing.MeanRpiDevUSecs(),
+            rx_timing.JitterUSecs(), rx_timing.max_queued_usecs );
+
         NotifyIoConnectionEvent( this, kIoConnectionEventTimedOut );
 
         if( producing_ncp.ConnectionType() == kIOConnTypeMulticast )
@@ -6,6 +6,8 @@
 #ifndef CIPCONNECTION_H_
 #define CIPCONNECTION_H_
 
+#include <string.h>
+
 #include "../enet_encap/sockaddr.h"
 #include "cipidentity.h"            // serial_number_
 
@@ -50,6 +52,45 @@
 /// You may change g_data.cc's g_my_io_udp_port instead.
 const int kEIP_IoUdpPort = 0x08AE;      // = 2222
 
+
+/**
+ * The granularity in usecs of the RPIs granted to I/O connections, which is
+ * also the smallest RPI.  Each connection is produced and watched on its own
+ * deadline, which the network handler wakes for between ticks, so this may
+ * be well below kCIPsterTimerTickInMicroSeconds without ManageConnections()
+ * being called any more often.
+ */
+#if !defined(CIPSTER_RPI_RESOLUTION_USECS)
+ #define CIPSTER_RPI_RESOLUTION_USECS   kCIPsterTimerTickInMicroSeconds
+#endif
+
+
+/// What a cyclic connection does when it produces more than one RPI late,
+/// i.e. the stack was stalled, see CIPSTER_LATE_PRODUCTION.
+#define CIPSTER_LATE_CATCH_UP           0   ///< produce once for every missed RPI
+#define CIPSTER_LATE_SKIP               1   ///< produce once, next on the original phase
+#define CIPSTER_LATE_REPHASE            2   ///< produce once, next one RPI from now
+
+/**
+ * One of the above.  Catching up sends the scanner a burst of back to back
+ * frames of the same data after a stall, the others send one fresh frame.
+ */
+#if !defined(CIPSTER_LATE_PRODUCTION)
+ #define CIPSTER_LATE_PRODUCTION        CIPSTER_LATE_CATCH_UP
+#endif
+
+
+/**
+ * When non-zero a cyclic connection being activated gets its first production
+ * at the phase within its RPI which collides least with those of the cyclic
+ * connections already active, see CipConnMgrClass::StaggerProduction().
+ * When zero, the default, it produces on the next tick, and connections of
+ * the same RPI opened together all produce on the same ticks.
+ */
+#if !defined(CIPSTER_STAGGER_PRODUCTION)
+ #define CIPSTER_STAGGER_PRODUCTION     0
+#endif
+
 class UdpSocket;
 
 /**
@@ -857,6 +898,56 @@ protected:
 };
 
 
+/**
+ * Struct RxStamp
+ * tells when a consumed I/O frame arrived, on the g_current_usecs time line,
+ * and how long it then waited in its socket before the stack took it.  Where
+ * the kernel does not timestamp frames it arrived when taken.
+ */
+struct RxStamp
+{
+    uint64_t    arrived_usecs;
+    uint32_t    queued_usecs;
+};
+
+
+/**
+ * Struct RxTiming
+ * is what a consuming connection saw of the arrival of the frames it
+ * accepted, since it was opened.  Its gaps and jitter are those of the
+ * originator and the network, while queued is the delay of this stack, so
+ * the two may be told apart when a connection faults.
+ */
+struct RxTiming
+{
+    uint32_t    frames;             ///< accepted, the first has no gap
+    uint32_t    max_gap_usecs;      ///< longest time between two of them
+    uint32_t    max_rpi_dev_usecs;  ///< largest difference of a gap from the RPI
+    uint64_t    sum_rpi_dev_usecs;  ///< of all frames - 1 such differences
+    uint32_t    jitter_x16;         ///< 16 times the smoothed difference
+    uint32_t    max_queued_usecs;   ///< longest wait in the socket
+    uint64_t    last_arrived_usecs;
+
+    void Clear()    { memset( this, 0, sizeof *this ); }
+
+    /**
+     * Function Note
+     * accounts for a frame arriving at @a aStamp, expected every @a aRpiUSecs.
+     */
+    void Note( const RxStamp& aStamp, uint32_t aRpiUSecs );
+
+    /// Return the inter-arrival jitter as in RFC 3550, taking the originator
+    /// to send exactly on its RPI.
+    uint32_t JitterUSecs() const        { return jitter_x16 >> 4; }
+
+    /// Return the mean difference of the gaps from the RPI.
+    uint32_t MeanRpiDevUSecs() const
+    {
+        return frames > 1 ? uint32_t( sum_rpi_dev_usecs / ( frames - 1 ) ) : 0;
+    }
+};
+
+
 /**
  * Class CipConn
  * holds data for a connection. This data is strongly related to
@@ -939,13 +1030,13 @@ public:
         uint32_t   adjusted = aRateUSecs;
 
         // The requested packet interval parameter needs to be a multiple of
-        // kCIPsterTimerTickInMicroSeconds from the user's header file
-        if( adjusted % kCIPsterTimerTickInMicroSeconds )
+        // CIPSTER_RPI_RESOLUTION_USECS
+        if( adjusted % CIPSTER_RPI_RESOLUTION_USECS )
         {
             // Vol1 3-4.4.9 Since aRateUSecs is not an exact multiple, round up to
             // slower nearest integer multiple of our timer.
-            adjusted = ( adjusted / kCIPsterTimerTickInMicroSeconds )
-                * kCIPsterTimerTickInMicroSeconds + kCIPsterTimerTickInMicroSeconds;
+            adjusted = ( adjusted / CIPSTER_RPI_RESOLUTION_USECS )
+                * CIPSTER_RPI_RESOLUTION_USECS + CIPSTER_RPI_RESOLUTION_USECS;
         }
 
         CIPSTER_TRACE_INFO( "%s( %d ) adjusted=%d\n", __func__, aRateUSecs, adjusted );
@@ -960,15 +1051,17 @@ public:
         return ret;
     }
 
+    /// Return the usecs until this connection may produce again, 0 if it may now.
     int32_t ProductionInhibitTimerUSecs() const
     {
-        int32_t ret = production_inhibit_timer_usecs - CurrentUSecs32();
+        // 64 bits since it may be long expired, the 32 bit timers would wrap.
+        int64_t ret = production_inhibit_timer_usecs - g_current_usecs;
         //CIPSTER_TRACE_INFO( "%s<%d>: %d\n", __func__, instance_id, ret );
-        return ret;
+        return ret > 0 ? int32_t( ret ) : 0;
     }
     CipConn& SetProductionInhibitTimerUSecs( int32_t aFuture )
     {
-        production_inhibit_timer_usecs = CurrentUSecs32() + aFuture;
+        production_inhibit_timer_usecs = g_current_usecs + aFuture;
         return *this;
     }
 
@@ -997,6 +1090,7 @@ public:
     {
         inactivity_watchdog_timer_usecs = CurrentUSecs32() + aFuture;
         //CIPSTER_TRACE_INFO( "%s<%d>( %d )\n", __func__, instance_id, inactivity_watchdog_timer_usecs );
+        timerMovedTo( inactivity_watchdog_timer_usecs );
         return *this;
     }
 
@@ -1008,6 +1102,19 @@ public:
                 || trigger.IsServer() ));
     }
 
+    /// Tell if this connection produces on its transmission trigger timer,
+    /// which CipConnMgrClass::ManageConnections() services.
+    bool ProducesOnTimer() const
+    {
+        // client connection, not server
+        return !trigger.IsServer()
+
+            && expected_packet_rate_usecs != 0
+
+            // only produce for the master connection
+            && producing_socket;
+    }
+
     /**
      * Function SndConnectedData
      * sends the data from the producing CIP object of the connection via the socket
@@ -1017,6 +1124,29 @@ public:
 
     EipStatus HandleReceivedIoConnectionData( BufReader aInput );
 
+    /**
+     * Function Class3Reply
+     * returns the serialized reply last sent on this explicit connection if
+     * it answered the request with @a aSequenceCount, else an empty BufReader.
+     * A request repeating the sequence count of the one before it is a
+     * retransmission, and gets this same reply without being performed again.
+     */
+    BufReader Class3Reply( uint16_t aSequenceCount ) const
+    {
+        if( class3_reply_valid && aSequenceCount == class3_reply_seq )
+            return BufReader( &class3_reply[0], class3_reply.size() );
+
+        return BufReader();
+    }
+
+    /// Remember @a aReply as the answer to the request with @a aSequenceCount.
+    void SetClass3Reply( uint16_t aSequenceCount, const BufReader& aReply )
+    {
+        class3_reply.assign( aReply.data(), aReply.data() + aReply.size() );
+        class3_reply_seq   = aSequenceCount;
+        class3_reply_valid = true;
+    }
+
     /**
      * Function Close
      * closes a connection. If it is an exclusive owner or input only
@@ -1027,6 +1157,9 @@ public:
     UdpSocket* ConsumingUdp() const  { return consuming_socket; }
     UdpSocket* ProducingUdp() const  { return producing_socket; }
 
+    /// Return the arrival statistics of the frames this connection consumed.
+    const RxTiming& RxStats() const  { return rx_timing; }
+
     void SetConsumingUdp( UdpSocket* aSocket )
     {
         consuming_socket  = aSocket;
@@ -1122,6 +1255,7 @@ protected:
     {
         //CIPSTER_TRACE_INFO( "%s<%d>( %d ) CID:0x%08x PID:0x%08x\n", __func__, instance_id, aUSecs, consuming_connection_id, producing_connection_id );
         transmission_trigger_timer_usecs = aUSecs;
+        timerMovedTo( transmission_trigger_timer_usecs );
         return *this;
     }
 
@@ -1179,17 +1313,69 @@ protected:
 
     // Timer for the production inhibition of application triggered or
     // change-of-state I/O connections.
-    uint32_t    production_inhibit_timer_usecs;
+    uint64_t    production_inhibit_timer_usecs;
 
     UdpSocket*  consuming_socket;
     UdpSocket*  producing_socket;
     CipUdint    encap_session;          // session_handle, 0 is not used.
 
+    // This connection's own produced frame, built once by buildTxFrame() so
+    // each SendConnectedData() need only patch in the fields which change.
+    std::vector<uint8_t>    tx_frame;
+    int         tx_eip_seq_at;          // offsets into tx_frame, 0 if absent
+    int         tx_seq_at;
+    int         tx_run_idle_at;
+    int         tx_data_at;             // where the assembly data goes
+
+    // The last reply sent on an explicit connection, see Class3Reply().
+    std::vector<uint8_t>    class3_reply;
+    uint16_t    class3_reply_seq;
+    bool        class3_reply_valid;
+
+    RxTiming    rx_timing;
+
+    /**
+     * Function buildTxFrame
+     * serializes the CPF items and data headers of the produced frame into
+     * tx_frame, with room after them for the producing assembly's data.
+     */
+    void buildTxFrame();
+
 private:
     // for active connection doubly linked list at g_active_conns
     CipConn*    next;
     CipConn*    prev;
     bool        on_list;
+
+    // for the timer queue in g_active_conns, a min heap on timer_key.
+    enum
+    {
+        kTimerNone      = -1,       ///< not in the timer queue
+        kTimerExpiring  = -2,       ///< taken off by ManageConnections()
+    };
+
+    int         timer_index;        // heap index, or one of the above
+    uint32_t    timer_key;          // earliest timer when queued, may be stale
+
+    // for the consuming connection id hash chains in g_active_conns
+    CipConn*    cid_next;
+
+    /**
+     * Function timerMovedTo
+     * is called when one of the timers has been set to @a aDeadline.
+     * A timer moving later is dealt with when the stale queue entry
+     * expires, only an earlier one has to be requeued now.
+     */
+    void timerMovedTo( uint32_t aDeadline )
+    {
+        if( on_list && timer_index != kTimerExpiring &&
+            ( timer_index == kTimerNone || int32_t( aDeadline - timer_key ) < 0 ) )
+        {
+            requeueTimers();
+        }
+    }
+
+    void requeueTimers();
 };
 
 
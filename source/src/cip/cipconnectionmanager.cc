@@ -4,6 +4,8 @@
  *
  ******************************************************************************/
 #include <string.h>
+#include <algorithm>
+#include <atomic>
 
 #include <byte_bufs.h>
 #include <trace.h>
@@ -18,7 +20,7 @@
 #include "cipassembly.h"
 #include "appcontype.h"
 #include "../enet_encap/encap.h"
-//#include "../enet_encap/networkhandler.h"   // IpAddrStr()
+#include "../enet_encap/networkhandler.h"   // UdpTxBatchBegin()
 #include "../enet_encap/encap.h"
 #include "../enet_encap/cpf.h"
 
@@ -46,7 +48,7 @@ CipConn* CipConnMgrClass::FindExistingMatchingConnection( const ConnectionData&
 
 
 EipStatus CipConnMgrClass::RecvConnectedData( UdpSocket* aSocket,
-        const SockAddr& aFromAddress, BufReader aCommand )
+        const SockAddr& aFromAddress, BufReader aCommand, const RxStamp& aStamp )
 {
     Cpf cpfd( aFromAddress, 0 );
     int result;
@@ -154,8 +156,14 @@ EipStatus CipConnMgrClass::RecvConnectedData( UdpSocket* aSocket,
             if( SEQ_GT32( cpfd.AddrEncapSeqNum(),
                           conn->eip_level_sequence_count_consuming ) )
             {
-                // reset the watchdog timer
-                conn->SetInactivityWatchDogTimerUSecs( conn->RxTimeoutUSecs() );
+                // Reset the watchdog timer, from when the frame arrived
+                // rather than from when it was taken, which may be after
+                // g_current_usecs.
+                int64_t age = int64_t( g_current_usecs - aStamp.arrived_usecs );
+
+                conn->SetInactivityWatchDogTimerUSecs( int32_t( conn->RxTimeoutUSecs() - age ) );
+
+                conn->rx_timing.Note( aStamp, conn->ExpectedPacketRateUSecs() );
 
                 conn->eip_level_sequence_count_consuming = cpfd.AddrEncapSeqNum();
 
@@ -181,18 +189,77 @@ EipStatus CipConnMgrClass::RecvConnectedData( UdpSocket* aSocket,
 }
 
 
-EipStatus CipConnMgrClass::ManageConnections()
+/**
+ * Function next_cyclic_production
+ * schedules the next production of cyclic connection @a aConn, which has
+ * just produced, according to CIPSTER_LATE_PRODUCTION.
+ */
+static void next_cyclic_production( CipConn* aConn )
 {
-    EipStatus eip_status;
+    int32_t rpi = aConn->ProducingRPI();
+
+    aConn->BumpTransmissionTriggerTimerUSecs( rpi );
+
+#if CIPSTER_LATE_PRODUCTION != CIPSTER_LATE_CATCH_UP
+    int32_t late = -aConn->TransmissionTriggerTimerUSecs();
+
+    // still due, so at least one whole RPI was missed
+    if( late >= 0 && rpi > 0 )
+    {
+        CIPSTER_TRACE_INFO( "%s<%d>: %d usecs late\n",
+            __func__, aConn->instance_id, late );
+
+ #if CIPSTER_LATE_PRODUCTION == CIPSTER_LATE_SKIP
+        // the first slot after now on the connection's original phase
+        aConn->BumpTransmissionTriggerTimerUSecs( ( late / rpi + 1 ) * rpi );
+ #else
+        aConn->SetTransmissionTriggerTimerUSecs( rpi );
+ #endif
+    }
+#endif
+}
+
 
+EipStatus CipConnMgrClass::ManageConnections()
+{
     // Check for application message triggers
     HandleApplication();
 
+    // including those notified from HandleApplication() just now
+    TriggerChangedAssemblies();
+
+#if !defined(CIPSTER_WITH_IO_THREAD)
+    // else the explicit thread calls it from NetworkHandlerProcessOnce()
     ManageEncapsulationMessages();
+#endif
 
-    for( CipConnBox::iterator active = g_active_conns.begin();
-            active != g_active_conns.end();  ++active )
+    return ServiceTimers();
+}
+
+
+EipStatus CipConnMgrClass::ServiceTimers()
+{
+    EipStatus eip_status;
+
+    // Take every due connection off the timer queue before servicing any,
+    // since servicing one can close others or move their timers.
+    static std::vector<CipConn*> due;
+
+    uint32_t    now = CurrentUSecs32();
+    CipConn*    active;
+
+    due.clear();
+
+    while( ( active = g_active_conns.PopExpired( now ) ) != NULL )
+        due.push_back( active );
+
+    // Connections due in the same tick go out in as few system calls as can be.
+    UdpTxBatchBegin();
+
+    for( unsigned i = 0; i < due.size();  ++i )
     {
+        active = due[i];
+
         if( active->State() == kConnStateEstablished )
         {
             // maybe check inactivity watchdog timer.
@@ -233,29 +300,42 @@ EipStatus CipConnMgrClass::ManageConnections()
             // only if the connection has not timed out check if data is to be sent
             if( active->State() == kConnStateEstablished )
             {
-                // client connection, not server
-                if( !active->trigger.IsServer()
-
-                    && active->ExpectedPacketRateUSecs() != 0
-
-                    // only produce for the master connection
-                    && active->ProducingUdp() )
+                if( active->ProducesOnTimer() )
                 {
-                    if( active->TransmissionTriggerTimerUSecs() <= 0 ) // need to send packet
+                    bool cyclic = active->trigger.Trigger() == kConnTriggerTypeCyclic;
+
+                    if( active->TransmissionTriggerTimerUSecs() > 0 )
+                    {
+                        // not yet
+                    }
+                    else if( !cyclic && active->ProductionInhibitTimerUSecs() > 0 )
+                    {
+                        // Triggered within the production inhibit time, Vol1
+                        // 3-4.4.17.  Produce once as it ends, however many
+                        // triggers arrive in between.
+                        active->SetTransmissionTriggerTimerUSecs(
+                                active->ProductionInhibitTimerUSecs() );
+                    }
+                    else    // need to send packet
                     {
                         eip_status = active->SendConnectedData();
 
+                        // Only an unbatched send fails here, UdpTxBatchFlush()
+                        // logs those of a batch itself.
                         if( eip_status == kEipStatusError )
                         {
                             CIPSTER_TRACE_ERR( "%s<%d>: ERROR sending UDP\n",
                                 __func__, active->instance_id );
                         }
 
-                        active->BumpTransmissionTriggerTimerUSecs( active->ProducingRPI() );
-
-                        if( active->trigger.Trigger() != kConnTriggerTypeCyclic )
+                        if( cyclic )
+                            next_cyclic_production( active );
+                        else
                         {
-                            // non cyclic connections have to reload the production inhibit timer
+                            // The RPI is the longest time between productions
+                            // of these, so it restarts now, as does the
+                            // production inhibit timer.
+                            active->SetTransmissionTriggerTimerUSecs( active->ProducingRPI() );
                             active->SetProductionInhibitTimerUSecs( active->GetPIT_USecs() );
                         }
                     }
@@ -264,10 +344,140 @@ EipStatus CipConnMgrClass::ManageConnections()
         }
     }
 
+    UdpTxBatchFlush();
+
+    // Requeue on the timers as they stand now, closed ones are not on the list.
+    for( unsigned i = 0; i < due.size();  ++i )
+        g_active_conns.QueueTimers( due[i] );
+
     return kEipStatusOk;
 }
 
 
+int32_t CipConnMgrClass::NextTimerUSecs( int32_t aLimit )
+{
+    return g_active_conns.NextTimerUSecs( CurrentUSecs32(), aLimit );
+}
+
+
+static unsigned gcd( unsigned a, unsigned b )
+{
+    while( b )
+    {
+        unsigned t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+
+/// Return the RPI of @a aConn in slots of CIPSTER_RPI_RESOLUTION_USECS.
+static unsigned rpi_slots( const CipConn* aConn )
+{
+    unsigned rpi = aConn->ProducingRPI() / CIPSTER_RPI_RESOLUTION_USECS;
+    return rpi ? rpi : 1;
+}
+
+
+/// Return the slot of the next production of @a aConn, 0 being now.  Slots
+/// are centered on multiples of CIPSTER_RPI_RESOLUTION_USECS from now, since
+/// now need not be on a tick.
+static unsigned next_slot( const CipConn* aConn )
+{
+    int32_t due = aConn->TransmissionTriggerTimerUSecs();
+    return due > 0 ? ( due + CIPSTER_RPI_RESOLUTION_USECS / 2 ) / CIPSTER_RPI_RESOLUTION_USECS : 0;
+}
+
+
+static bool is_cyclic_producer( const CipConn* aConn )
+{
+    return aConn->ProducesOnTimer()
+        && aConn->Transport().Trigger() == kConnTriggerTypeCyclic;
+}
+
+
+void CipConnMgrClass::StaggerProduction( CipConn* aConn )
+{
+    unsigned    rpi = rpi_slots( aConn );
+    unsigned    candidates = std::min( rpi, unsigned( kMaxStaggerSlots ) );
+    unsigned    best = 0;
+    uint32_t    best_cost = ~0u;
+
+    // The productions of aConn in slots s + k * rpi meet those of another
+    // in slots n + k * other_rpi on a 1 in other_rpi / g of its own, where g
+    // is the gcd of the RPIs, if and only if s and n are congruent modulo g.
+    // So sum over the others these fractions met, in 16 bit fixed point, and
+    // take the slot summing least, the soonest of equals.
+    for( unsigned s = 0;  s < candidates && best_cost;  ++s )
+    {
+        uint32_t cost = 0;
+
+        for( CipConnBox::iterator it = g_active_conns.begin();
+                it != g_active_conns.end();  ++it )
+        {
+            if( !is_cyclic_producer( it ) )
+                continue;
+
+            unsigned other_rpi = rpi_slots( it );
+            unsigned g = gcd( rpi, other_rpi );
+
+            if( s % g == next_slot( it ) % g )
+                cost += ( g << 16 ) / other_rpi;
+        }
+
+        if( cost < best_cost )
+        {
+            best_cost = cost;
+            best = s;
+        }
+    }
+
+    CIPSTER_TRACE_INFO( "%s<%d>: slot %u of %u, meeting %u/65536 of the time\n",
+        __func__, aConn->instance_id, best, rpi, best_cost );
+
+    aConn->SetTransmissionTriggerTimerUSecs( best * CIPSTER_RPI_RESOLUTION_USECS );
+}
+
+
+int CipConnMgrClass::ProductionSlotLoad( std::vector<int>* aLoad )
+{
+    unsigned slots = 0;
+
+    for( CipConnBox::iterator it = g_active_conns.begin();
+            it != g_active_conns.end();  ++it )
+    {
+        if( is_cyclic_producer( it ) )
+            slots = std::max( slots, rpi_slots( it ) );
+    }
+
+    aLoad->assign( std::min( slots, unsigned( kMaxStaggerSlots ) ), 0 );
+
+    int worst = 0;
+
+    for( CipConnBox::iterator it = g_active_conns.begin();
+            it != g_active_conns.end();  ++it )
+    {
+        if( !is_cyclic_producer( it ) )
+            continue;
+
+        unsigned rpi = rpi_slots( it );
+
+        // one due an RPI from now is also due in the slot of now, modulo RPI
+        for( unsigned s = next_slot( it ) % rpi;  s < aLoad->size();  s += rpi )
+            worst = std::max( worst, ++(*aLoad)[s] );
+    }
+
+    return worst;
+}
+
+
+static void close_session( void* aSessionHandle )
+{
+    SessionMgr::CloseBySessionHandle( CipUdint( uintptr_t( aSessionHandle ) ) );
+}
+
+
 void CipConnMgrClass::CheckForTimedOutConnectionsAndCloseTCPConnections( CipUdint aSessionHandle )
 {
     bool another_active_with_same_session_found = false;
@@ -288,22 +498,26 @@ void CipConnMgrClass::CheckForTimedOutConnectionsAndCloseTCPConnections( CipUdin
     if( !another_active_with_same_session_found )
     {
         CIPSTER_TRACE_INFO( "%s: killing session:%d\n", __func__, aSessionHandle );
-        SessionMgr::CloseBySessionHandle( aSessionHandle );
+
+        // The sessions belong to the explicit thread, if apart from this one.
+        ExplicitThreadPost( close_session, (void*) uintptr_t( aSessionHandle ) );
     }
 }
 
 
-void CipConnMgrClass::CloseClass3Connections( CipUdint aSessionHandle )
+static void close_class3_connections( void* aSessionHandle )
 {
+    CipUdint session_handle = *(CipUdint*) aSessionHandle;
+
     CipConnBox::iterator it = g_active_conns.begin();
 
     while( it != g_active_conns.end() )
     {
-        if( it->trigger.Class() == kConnTransportClass3 &&
-            it->SessionHandle() == aSessionHandle )
+        if( it->Transport().Class() == kConnTransportClass3 &&
+            it->SessionHandle() == session_handle )
         {
             CIPSTER_TRACE_INFO( "%s: closing class 3 on session:%d\n",
-                __func__, aSessionHandle );
+                __func__, session_handle );
 
             CipConnBox::iterator to_close = it;
 
@@ -316,24 +530,16 @@ void CipConnMgrClass::CloseClass3Connections( CipUdint aSessionHandle )
 }
 
 
-CipConn* GetConnectionByConsumingId( int aConnectionId )
+void CipConnMgrClass::CloseClass3Connections( CipUdint aSessionHandle )
 {
-    CipConnBox::iterator c = g_active_conns.begin();
-
-    while( c != g_active_conns.end() )
-    {
-        if( c->State() == kConnStateEstablished )
-        {
-            if( c->ConsumingConnectionId() == aConnectionId )
-            {
-                return c;
-            }
-        }
+    // The connections belong to the I/O thread, if apart from this one.
+    IoThreadCall( close_class3_connections, &aSessionHandle );
+}
 
-        ++c;
-    }
 
-    return NULL;
+CipConn* GetConnectionByConsumingId( int aConnectionId )
+{
+    return g_active_conns.FindByConsumingId( aConnectionId );
 }
 
 
@@ -379,6 +585,15 @@ bool CipConnBox::Insert( CipConn* aConn )
     head = aConn;
     aConn->on_list = true;
 
+    // Push onto the front of its chain so a lookup finds the newest first,
+    // the same one a walk of the list from head would find.
+    CipConn** bucket = &by_cid[cid_bucket( aConn->ConsumingConnectionId() )];
+
+    aConn->cid_next = *bucket;
+    *bucket = aConn;
+
+    QueueTimers( aConn );
+
     return true;
 }
 
@@ -411,13 +626,168 @@ bool CipConnBox::Remove( CipConn* aConn )
         aConn->next->prev = aConn->prev;
     }
 
+    CipConn** link = &by_cid[cid_bucket( aConn->ConsumingConnectionId() )];
+
+    while( *link && *link != aConn )
+        link = &(*link)->cid_next;
+
+    CIPSTER_ASSERT( *link );    // consuming id changed while on list?
+
+    if( *link )
+        *link = aConn->cid_next;
+
     aConn->prev  = NULL;
     aConn->next  = NULL;
+    aConn->cid_next = NULL;
     aConn->on_list = false;
+
+    if( aConn->timer_index >= 0 )
+        heap_remove( aConn );
+    else
+        aConn->timer_index = CipConn::kTimerNone;
+
     return true;
 }
 
 
+void CipConnBox::QueueTimers( CipConn* aConn )
+{
+    if( !aConn->on_list )
+    {
+        aConn->timer_index = CipConn::kTimerNone;
+        return;
+    }
+
+    bool        running = false;
+    uint32_t    key = 0;
+
+    if( aConn->HasInactivityWatchDogTimer() )
+    {
+        key = aConn->inactivity_watchdog_timer_usecs;
+        running = true;
+    }
+
+    if( aConn->ProducesOnTimer() )
+    {
+        uint32_t trigger = aConn->transmission_trigger_timer_usecs;
+
+        if( !running || int32_t( trigger - key ) < 0 )
+            key = trigger;
+
+        running = true;
+    }
+
+    if( !running )
+    {
+        if( aConn->timer_index >= 0 )
+            heap_remove( aConn );
+        else
+            aConn->timer_index = CipConn::kTimerNone;
+        return;
+    }
+
+    if( aConn->timer_index < 0 )
+    {
+        aConn->timer_key = key;
+        timers.push_back( aConn );
+        aConn->timer_index = timers.size() - 1;
+        sift_up( aConn->timer_index );
+    }
+    else
+    {
+        bool sooner = int32_t( key - aConn->timer_key ) < 0;
+
+        aConn->timer_key = key;
+
+        if( sooner )
+            sift_up( aConn->timer_index );
+        else
+            sift_down( aConn->timer_index );
+    }
+}
+
+
+CipConn* CipConnBox::PopExpired( uint32_t aNow )
+{
+    if( timers.empty() || int32_t( timers[0]->timer_key - aNow ) > 0 )
+        return NULL;
+
+    CipConn* top = timers[0];
+
+    heap_remove( top );
+    top->timer_index = CipConn::kTimerExpiring;
+
+    return top;
+}
+
+
+void CipConnBox::sift_up( int aIndex )
+{
+    CipConn* conn = timers[aIndex];
+
+    while( aIndex > 0 )
+    {
+        int parent = ( aIndex - 1 ) / 2;
+
+        if( !earlier( conn, timers[parent] ) )
+            break;
+
+        heap_set( aIndex, timers[parent] );
+        aIndex = parent;
+    }
+
+    heap_set( aIndex, conn );
+}
+
+
+void CipConnBox::sift_down( int aIndex )
+{
+    CipConn*    conn = timers[aIndex];
+    int         count = timers.size();
+
+    for(;;)
+    {
+        int child = 2 * aIndex + 1;
+
+        if( child >= count )
+            break;
+
+        if( child + 1 < count && earlier( timers[child+1], timers[child] ) )
+            ++child;
+
+        if( !earlier( timers[child], conn ) )
+            break;
+
+        heap_set( aIndex, timers[child] );
+        aIndex = child;
+    }
+
+    heap_set( aIndex, conn );
+}
+
+
+void CipConnBox::heap_remove( CipConn* aConn )
+{
+    int         index = aConn->timer_index;
+    CipConn*    last  = timers.back();
+
+    timers.pop_back();
+    aConn->timer_index = CipConn::kTimerNone;
+
+    if( last != aConn )
+    {
+        bool sooner = earlier( last, aConn );
+
+        heap_set( index, last );
+
+        if( sooner )
+            sift_up( index );
+        else
+            sift_down( index );
+    }
+}
+
+
 bool IsConnectedInputAssembly( int aInstanceId )
 {
     CipConnBox::iterator c = g_active_conns.begin();
@@ -446,6 +816,22 @@ bool IsConnectedOutputAssembly( int aInstanceId )
 }
 
 
+/**
+ * Function trigger_production
+ * has application triggered or change of state connection @a aConn produce
+ * at the earliest time its production inhibit timer allows, unless it is
+ * due sooner already.  So the triggers within one inhibit time coalesce into
+ * a single production.
+ */
+static void trigger_production( CipConn* aConn )
+{
+    int32_t inhibit_usecs = aConn->ProductionInhibitTimerUSecs();
+
+    if( inhibit_usecs < aConn->TransmissionTriggerTimerUSecs() )
+        aConn->SetTransmissionTriggerTimerUSecs( inhibit_usecs );
+}
+
+
 EipStatus TriggerConnections( int aOutputAssembly, int aInputAssembly )
 {
     EipStatus ret = kEipStatusError;
@@ -460,7 +846,7 @@ EipStatus TriggerConnections( int aOutputAssembly, int aInputAssembly )
             if( c->Transport().Trigger() == kConnTriggerTypeApplication )
             {
                 // produce at the next allowed occurrence
-                c->SetTransmissionTriggerTimerUSecs( c->ProductionInhibitTimerUSecs() );
+                trigger_production( c );
                 ret = kEipStatusOk;
             }
 
@@ -472,6 +858,87 @@ EipStatus TriggerConnections( int aOutputAssembly, int aInputAssembly )
 }
 
 
+// Input assemblies given to NotifyAssemblyChanged() and not yet triggered, one
+// bit per instance id, and one bit in s_changed_words per word of s_changed.
+// Words are unsigned long, which unlike uint64_t has lock-free atomics on the
+// 32 bit targets too, and only a lock-free fetch_or is signal safe.
+typedef unsigned long   ChangedWord;
+
+static_assert( ATOMIC_LONG_LOCK_FREE == 2,
+    "NotifyAssemblyChanged() needs lock-free atomic unsigned long to be signal safe" );
+
+enum { kChangedBits = sizeof(ChangedWord) * 8 };
+
+static std::atomic<ChangedWord> s_changed[65536 / kChangedBits];
+static std::atomic<ChangedWord> s_changed_words[65536 / kChangedBits / kChangedBits];
+
+
+EipStatus NotifyAssemblyChanged( int aInputAssembly )
+{
+    unsigned id = aInputAssembly;
+
+    if( id >= 65536 )
+        return kEipStatusError;
+
+    unsigned w = id / kChangedBits;
+
+    // The word first, so that a trigger seeing the summary bit finds it.
+    s_changed[w].fetch_or( ChangedWord( 1 ) << ( id % kChangedBits ),
+            std::memory_order_release );
+
+    s_changed_words[w / kChangedBits].fetch_or( ChangedWord( 1 ) << ( w % kChangedBits ),
+            std::memory_order_release );
+
+    NetworkHandlerWake();
+
+    return kEipStatusOk;
+}
+
+
+/**
+ * Function trigger_assembly
+ * triggers each application triggered or change of state connection
+ * producing input assembly @a aInputAssembly.
+ */
+static void trigger_assembly( int aInputAssembly )
+{
+    CipConnBox::iterator c = g_active_conns.begin();
+
+    for(  ; c != g_active_conns.end(); ++c )
+    {
+        if( c->Transport().Trigger() != kConnTriggerTypeCyclic &&
+            c->ProducesOnTimer() &&
+            aInputAssembly == c->ProducingPath().GetInstanceOrConnPt() )
+        {
+            trigger_production( c );
+        }
+    }
+}
+
+
+void CipConnMgrClass::TriggerChangedAssemblies()
+{
+    for( int s = 0; s < DIM( s_changed_words );  ++s )
+    {
+        ChangedWord words = s_changed_words[s].exchange( 0, std::memory_order_acquire );
+
+        for( int w = s * kChangedBits;  words;  ++w, words >>= 1 )
+        {
+            if( !( words & 1 ) )
+                continue;
+
+            ChangedWord bits = s_changed[w].exchange( 0, std::memory_order_acquire );
+
+            for( int id = w * kChangedBits;  bits;  ++id, bits >>= 1 )
+            {
+                if( bits & 1 )
+                    trigger_assembly( id );
+            }
+        }
+    }
+}
+
+
 EipStatus CipConnMgrClass::forward_open( CipInstance* instance,
         CipMessageRouterRequest* request,
         CipMessageRouterResponse* response, bool isLarge )
@@ -555,21 +1022,21 @@ EipStatus CipConnMgrClass::forward_open( CipInstance* instance,
 
     // Vol1 3-5.4.1.2  Requested and Actual Packet Intervals
     // The actual packet interval parameter needs to be a multiple of
-    // kCIPsterTimerTickInMicroSeconds from the user's header file
+    // CIPSTER_RPI_RESOLUTION_USECS
 
     consuming_API_usecs = params.consuming_RPI_usecs;
 
-    if( consuming_API_usecs % kCIPsterTimerTickInMicroSeconds )
+    if( consuming_API_usecs % CIPSTER_RPI_RESOLUTION_USECS )
     {
         // find next "faster" multiple
-        consuming_API_usecs = (consuming_API_usecs / kCIPsterTimerTickInMicroSeconds)
-            * kCIPsterTimerTickInMicroSeconds;
+        consuming_API_usecs = (consuming_API_usecs / CIPSTER_RPI_RESOLUTION_USECS)
+            * CIPSTER_RPI_RESOLUTION_USECS;
 
         if( consuming_API_usecs == 0 )
         {
             CIPSTER_TRACE_ERR(
                 "%s: consuming_RPI of %d is less than minimum of %d usecs\n",
-                __func__,  params.consuming_RPI_usecs, kCIPsterTimerTickInMicroSeconds );
+                __func__,  params.consuming_RPI_usecs, CIPSTER_RPI_RESOLUTION_USECS );
 
             ext_status = kConnMgrStatusRPINotSupported;
             goto forward_open_response;
@@ -587,17 +1054,17 @@ EipStatus CipConnMgrClass::forward_open( CipInstance* instance,
 
     producing_API_usecs = params.producing_RPI_usecs;
 
-    if( producing_API_usecs % kCIPsterTimerTickInMicroSeconds )
+    if( producing_API_usecs % CIPSTER_RPI_RESOLUTION_USECS )
     {
         // find next "faster" multiple
-        producing_API_usecs = (producing_API_usecs / kCIPsterTimerTickInMicroSeconds)
-            * kCIPsterTimerTickInMicroSeconds;
+        producing_API_usecs = (producing_API_usecs / CIPSTER_RPI_RESOLUTION_USECS)
+            * CIPSTER_RPI_RESOLUTION_USECS;
 
         if( producing_API_usecs == 0 )
         {
             CIPSTER_TRACE_ERR(
                 "%s: producing_RPI of %d is less than minimum of %d usecs\n",
-                __func__,  params.producing_RPI_usecs, kCIPsterTimerTickInMicroSeconds );
+                __func__,  params.producing_RPI_usecs, CIPSTER_RPI_RESOLUTION_USECS );
 
             ext_status = kConnMgrStatusRPINotSupported;
             goto forward_open_response;
@@ -6,6 +6,8 @@
 #ifndef CIPSTER_CIPCONNECTIONMANAGER_H_
 #define CIPSTER_CIPCONNECTIONMANAGER_H_
 
+#include <vector>
+
 #include <cipster_user_conf.h>
 #include <typedefs.h>
 #include "ciptypes.h"
@@ -22,6 +24,59 @@ public:
 
     static EipStatus ManageConnections();
 
+    /**
+     * Function ServiceTimers
+     * is the part of ManageConnections() which services each connection
+     * whose inactivity watchdog or transmission trigger timer is due, which
+     * the network handler also calls between ticks for one which is due.
+     */
+    static EipStatus ServiceTimers();
+
+    /**
+     * Function TriggerChangedAssemblies
+     * triggers the connections producing each input assembly given to
+     * NotifyAssemblyChanged() since the last call.  Only the thread running
+     * ManageConnections() may call it.
+     */
+    static void TriggerChangedAssemblies();
+
+    /**
+     * Function NextTimerUSecs
+     * returns the number of usecs until the earliest inactivity watchdog or
+     * transmission trigger timer of an established connection expires, as
+     * seen by ManageConnections().
+     *
+     * @param aLimit is returned if no timer expires sooner.
+     * @return int32_t - usecs relative to CurrentUSecs32(), <= 0 if already due.
+     */
+    static int32_t NextTimerUSecs( int32_t aLimit );
+
+    /// The most slots of CIPSTER_RPI_RESOLUTION_USECS looked at by
+    /// StaggerProduction() and ProductionSlotLoad().
+    enum { kMaxStaggerSlots = 1000 };
+
+    /**
+     * Function StaggerProduction
+     * sets the first transmission trigger of cyclic connection @a aConn,
+     * not yet active, to the slot within its RPI which collides least with
+     * the productions of the cyclic connections already active.  So those of
+     * the same RPI opened together spread across the RPI rather than all
+     * producing in the same ManageConnections() pass.
+     */
+    static void StaggerProduction( CipConn* aConn );
+
+    /**
+     * Function ProductionSlotLoad
+     * reports how the productions of the active cyclic connections fall into
+     * slots of CIPSTER_RPI_RESOLUTION_USECS, starting with the current one.
+     * Only the thread running ManageConnections() may call it.
+     *
+     * @param aLoad is filled with the count of productions due in each slot,
+     *  for as many slots as the longest RPI spans, at most kMaxStaggerSlots.
+     * @return int - the largest count, i.e. the worst burst.
+     */
+    static int ProductionSlotLoad( std::vector<int>* aLoad );
+
     /**
      * Function CloseClass3Connections
      * closes all class 3 connections having @a aSessionHandle.
@@ -65,11 +120,12 @@ public:
      *           connection hijacking
      * @param aCommand received data buffer pointing just past the
      *   encapsulation header and a byte count remaining in frame.
-     * @param aReply where to put the reply and tells its maximum length.
+     * @param aStamp tells when the frame arrived.  The inactivity watchdog
+     *   runs from then, and the connection's RxStats() account for it.
      * @return EipStatus
      */
     static EipStatus RecvConnectedData( UdpSocket* aSocket,
-        const SockAddr& aFromAddress, BufReader aCommand );
+        const SockAddr& aFromAddress, BufReader aCommand, const RxStamp& aStamp );
 
     //-----<CipServiceFunctions>------------------------------------------------
     static EipStatus forward_open_service( CipInstance* instance,
@@ -179,6 +235,11 @@ bool IsConnectedOutputAssembly( int aInstanceId );
  * Class CipConnBox
  * is a containter for CipConns (likely to be replace with std::vector some day).
  * Used to hold an active list of CipConns, using CipConn->prev and ->next.
+ * It also keeps the CipConns having a running inactivity watchdog or
+ * transmission trigger timer in a binary min heap ordered on the earliest
+ * of those two deadlines, so that ManageConnections() need only visit the
+ * connections which are due, and hashes them on consuming connection id
+ * for the per packet lookup done by GetConnectionByConsumingId().
  */
 class CipConnBox
 {
@@ -186,7 +247,10 @@ public:
 
     CipConnBox() :
         head( NULL )
-    {}
+    {
+        for( int i = 0; i < kCidBuckets; ++i )
+            by_cid[i] = NULL;
+    }
 
     /// Class CipConnBox::iterator walks the linked list and mimics a pointer
     /// when the dereferencing operators and cast are used.
@@ -250,8 +314,93 @@ public:
     iterator end()      const   { return iterator( NULL ); }
     iterator begin()    const   { return iterator( head ); }
 
+    /**
+     * Function FindByConsumingId
+     * @return CipConn* - the most recently inserted established connection
+     *  having @a aConnectionId as its consuming connection id, or NULL.
+     */
+    CipConn* FindByConsumingId( CipUdint aConnectionId ) const
+    {
+        CipConn* c = by_cid[cid_bucket( aConnectionId )];
+
+        for(  ; c;  c = c->cid_next )
+        {
+            if( c->ConsumingConnectionId() == aConnectionId &&
+                c->State() == kConnStateEstablished )
+            {
+                return c;
+            }
+        }
+
+        return NULL;
+    }
+
+    /**
+     * Function QueueTimers
+     * puts @a aConn into the timer queue keyed on its earliest running
+     * timer, moves it if already there, or takes it out if it has no running
+     * timer.  Does nothing for a CipConn which is not on this list.
+     */
+    void QueueTimers( CipConn* aConn );
+
+    /**
+     * Function PopExpired
+     * takes the earliest CipConn off the timer queue if its timer is due
+     * at @a aNow.  It stays off the queue until given back to QueueTimers().
+     *
+     * @return CipConn* - the due connection or NULL if none is due.
+     */
+    CipConn* PopExpired( uint32_t aNow );
+
+    /**
+     * Function NextTimerUSecs
+     * @return int32_t - usecs from @a aNow until the earliest queued timer,
+     *  or @a aLimit if that is sooner or nothing is queued.
+     */
+    int32_t NextTimerUSecs( uint32_t aNow, int32_t aLimit ) const
+    {
+        if( timers.empty() )
+            return aLimit;
+
+        int32_t remaining = timers[0]->timer_key - aNow;
+
+        return remaining < aLimit ? remaining : aLimit;
+    }
+
 protected:
     CipConn* head;
+
+    enum
+    {
+        kCidHashBits = 6,
+        kCidBuckets  = 1 << kCidHashBits,
+    };
+
+    // Connection ids we choose differ only in their low bits, ones the
+    // originator chooses can be anything, so mix them all into the top bits.
+    static unsigned cid_bucket( CipUdint aConnectionId )
+    {
+        return uint32_t( aConnectionId * 2654435761u ) >> ( 32 - kCidHashBits );
+    }
+
+    CipConn*    by_cid[kCidBuckets];    // chained on CipConn::cid_next
+
+    std::vector<CipConn*>   timers;     // min heap on CipConn::timer_key
+
+    static bool earlier( const CipConn* a, const CipConn* b )
+    {
+        return int32_t( a->timer_key - b->timer_key ) < 0;
+    }
+
+    void heap_set( int aIndex, CipConn* aConn )
+    {
+        timers[aIndex] = aConn;
+        aConn->timer_index = aIndex;
+    }
+
+    void sift_up( int aIndex );
+    void sift_down( int aIndex );
+    void heap_remove( CipConn* aConn );
 };
 
 extern CipConnBox g_active_conns;
@@ -8,7 +8,14 @@
 
 #include "cipster_api.h"
 #include "cipcommon.h"
-#include "cipmessagerouter.h"
+#include "cipmessagerouter.h"   // CIPSTER_MR_WORKERS
+
+#if CIPSTER_MR_WORKERS
+ #include <pthread.h>
+ #include <unistd.h>
+ #include <exception>
+#endif
+
 #include "cipconnectionmanager.h"
 #include "cipconnection.h"
 #include "byte_bufs.h"
@@ -190,6 +197,9 @@ CipMessageRouterClass::CipMessageRouterClass() :
     // Also, conformance test tool does not like SetAttributeSingle on this class,
     // delete the service which was established in CipClass constructor.
     delete ServiceRemove( _I, kSetAttributeSingle );
+
+    ServiceInsert( _I, kMultipleServicePacket, multiple_service_packet_service,
+        "MultipleServicePacket" );
 }
 
 
@@ -266,56 +276,316 @@ EipStatus CipMessageRouterClass::Init()
 }
 
 
-EipStatus CipMessageRouterClass::NotifyMR(
+#if CIPSTER_MR_WORKERS
+
+/**
+ * Struct MrJob
+ * is a thread safe service being performed by a worker for a session, with
+ * copies of its request and reply since the session's buffers may go away.
+ */
+struct MrJob
+{
+    MrJob( CipService* aService, CipInstance* aInstance,
+            const CipMessageRouterRequest& aRequest, CipUdint aSessionHandle ) :
+        session_handle( aSessionHandle ),
+        service( aService ),
+        instance( aInstance ),
+        request( aRequest ),
+        request_data( aRequest.Data().data(),
+                      aRequest.Data().data() + aRequest.Data().size() ),
+        reply( CIPSTER_MESSAGE_DATA_REPLY_BUFFER ),
+        response( NULL, BufWriter( reply.data(), reply.size() ) ),
+        status( kEipStatusError ),
+        done( false ),
+        next( NULL )
+    {
+        request.SetData( BufReader( request_data.data(), request_data.size() ) );
+        response.SetService( aRequest.Service() );
+    }
+
+    /// Tell if @a aRequest to @a aInstance is the one performed here.
+    bool Matches( CipService* aService, CipInstance* aInstance,
+            const CipMessageRouterRequest& aRequest ) const
+    {
+        const BufReader& data = aRequest.Data();
+
+        return service == aService && instance == aInstance &&
+               data.size() == request_data.size() &&
+               !memcmp( data.data(), request_data.data(), data.size() );
+    }
+
+    CipUdint                    session_handle;     // 0 once the session closed
+    CipService*                 service;
+    CipInstance*                instance;
+    CipMessageRouterRequest     request;
+    std::vector<uint8_t>        request_data;
+    std::vector<uint8_t>        reply;
+    CipMessageRouterResponse    response;
+    EipStatus                   status;
+    std::exception_ptr          error;              // what the service threw
+    bool                        done;               // taken by TakeFinished()
+    MrJob*                      next;
+};
+
+
+// The lock guards the two queues and s_stopping, the rest of an MrJob is
+// only touched by the one thread which has it off the queues.
+static pthread_mutex_t  s_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   s_work = PTHREAD_COND_INITIALIZER;
+
+static MrJob*       s_todo;             // FIFO of jobs for the workers
+static MrJob*       s_todo_tail;
+static MrJob*       s_finished;         // FIFO of jobs for TakeFinished()
+static MrJob*       s_finished_tail;
+static bool         s_stopping;
+static int          s_done_fd = -1;
+
+static pthread_t    s_workers[CIPSTER_MR_WORKERS];
+static int          s_worker_count;
+
+// each session's job, indexed by session handle - 1
+static MrJob*       s_jobs[CIPSTER_NUMBER_OF_SUPPORTED_SESSIONS];
+
+// non-zero while NotifyMR() is performing a Multiple Service Packet's services
+static int          s_embedding;
+
+
+static void push( MrJob** aHead, MrJob** aTail, MrJob* aJob )
+{
+    aJob->next = NULL;
+
+    if( *aHead )
+        (*aTail)->next = aJob;
+    else
+        *aHead = aJob;
+
+    *aTail = aJob;
+}
+
+
+static MrJob* pop( MrJob** aHead )
+{
+    MrJob* job = *aHead;
+
+    if( job )
+        *aHead = job->next;
+
+    return job;
+}
+
+
+static void* worker_main( void* )
+{
+    pthread_mutex_lock( &s_lock );
+
+    while( !s_stopping )
+    {
+        MrJob* job = pop( &s_todo );
+
+        if( !job )
+        {
+            pthread_cond_wait( &s_work, &s_lock );
+            continue;
+        }
+
+        pthread_mutex_unlock( &s_lock );
+
+        try
+        {
+            job->status = job->service->service_function(
+                            job->instance, &job->request, &job->response );
+        }
+        catch( ... )
+        {
+            job->error = std::current_exception();
+        }
+
+        pthread_mutex_lock( &s_lock );
+
+        push( &s_finished, &s_finished_tail, job );
+
+        uint64_t one = 1;
+
+        if( write( s_done_fd, &one, sizeof one ) < 0 )
+        {
+            CIPSTER_TRACE_ERR( "%s: write errno:%d\n", __func__, errno );
+        }
+    }
+
+    pthread_mutex_unlock( &s_lock );
+
+    return NULL;
+}
+
+
+/**
+ * Function deferred
+ * gives @a aRequest to a worker, or once the worker has finished, copies
+ * its reply into @a aResponse.
+ */
+static EipStatus deferred( CipService* aService, CipInstance* aInstance,
         CipMessageRouterRequest* aRequest, CipMessageRouterResponse* aResponse )
 {
-    CIPSTER_TRACE_INFO( "%s: routing...\n", __func__ );
+    CipUdint    session_handle = aResponse->CPF()->SessionHandle();
+    MrJob*&     job = s_jobs[session_handle - 1];
 
-    aResponse->SetService( aRequest->Service() );
+    if( job )
+    {
+        // The session is not read while its job is with a worker.
+        if( !job->done )
+            return kEipStatusPending;
 
-    CipClass* clazz = NULL;
+        MrJob* finished = job;
 
-    int instance_id;
+        job = NULL;
 
-    if( aRequest->Path().HasSymbol() )
+        if( finished->Matches( aService, aInstance, *aRequest ) )
+        {
+            const CipMessageRouterResponse& r = finished->response;
+
+            aResponse->SetGenStatus( r.GenStatus() );
+
+            for( int i = 0; i < r.AdditionalStsCount();  ++i )
+                aResponse->AddAdditionalSts( r.AdditionalSts( i ) );
+
+            aResponse->Writer().append( r.Reader() );
+            aResponse->SetWrittenSize( r.WrittenSize() );
+
+            EipStatus           status = finished->status;
+            std::exception_ptr  error  = finished->error;
+
+            delete finished;
+
+            if( error )
+                std::rethrow_exception( error );
+
+            return status;
+        }
+
+        delete finished;
+    }
+
+    job = new MrJob( aService, aInstance, *aRequest, session_handle );
+
+    CIPSTER_TRACE_INFO( "%s: session:%u service:'%s' to worker\n",
+        __func__, session_handle, aService->ServiceName().c_str() );
+
+    pthread_mutex_lock( &s_lock );
+    push( &s_todo, &s_todo_tail, job );
+    pthread_cond_signal( &s_work );
+    pthread_mutex_unlock( &s_lock );
+
+    return kEipStatusPending;
+}
+
+
+EipStatus CipMessageRouterClass::StartWorkers( int aDoneFd )
+{
+    s_done_fd  = aDoneFd;
+    s_stopping = false;
+
+    for( s_worker_count = 0;  s_worker_count < CIPSTER_MR_WORKERS;  ++s_worker_count )
     {
-        // Per Rockwell Automation Publication 1756-PM020D-EN-P - June 2016:
-        // Symbol Class Id is 0x6b.  Forward this request to that class.
-        // This class is not implemented in CIPster stack, but can be added by
-        // an application using simple RegisterCipClass( CipClass* aClass );
-        // Instances of this class are tags.
-        // I have such an implementation in my application.
+        int error = pthread_create( &s_workers[s_worker_count], NULL, worker_main, NULL );
 
-        instance_id = 0;   // talk to class 0x6b instance 0
+        if( error )
+        {
+            CIPSTER_TRACE_ERR( "%s: pthread_create() error:%d\n", __func__, error );
+            return kEipStatusError;
+        }
+    }
 
-        clazz = GetCipClass( 0x6b );
+    return kEipStatusOk;
+}
+
+
+void CipMessageRouterClass::StopWorkers()
+{
+    pthread_mutex_lock( &s_lock );
+    s_stopping = true;
+    pthread_cond_broadcast( &s_work );
+    pthread_mutex_unlock( &s_lock );
+
+    while( s_worker_count )
+        pthread_join( s_workers[--s_worker_count], NULL );
+
+    MrJob* job;
+
+    // Those of closed sessions are only on the queues, the rest in s_jobs.
+    while( ( job = pop( &s_todo ) ) != NULL )
+    {
+        if( !job->session_handle )
+            delete job;
     }
-    else if( aRequest->Path().HasInstance() )
+
+    while( ( job = pop( &s_finished ) ) != NULL )
     {
-        instance_id = aRequest->Path().GetInstance();
-        clazz = GetCipClass( aRequest->Path().GetClass() );
+        if( !job->session_handle )
+            delete job;
     }
-    else
+
+    for( int i = 0; i < DIM( s_jobs );  ++i )
     {
-        CIPSTER_TRACE_WARN( "%s: no instance specified\n", __func__ );
+        delete s_jobs[i];
+        s_jobs[i] = NULL;
+    }
+}
 
-        // instance_id was not in the request
-        aResponse->SetGenStatus( kCipErrorPathDestinationUnknown );
-        return kEipStatusOkSend;
+
+CipUdint CipMessageRouterClass::TakeFinished()
+{
+    for(;;)
+    {
+        pthread_mutex_lock( &s_lock );
+        MrJob* job = pop( &s_finished );
+        pthread_mutex_unlock( &s_lock );
+
+        if( !job )
+            return 0;
+
+        if( job->session_handle )
+        {
+            job->done = true;
+            return job->session_handle;
+        }
+
+        delete job;     // its session closed
     }
+}
 
-    if( !clazz )
+
+void CipMessageRouterClass::ForgetSession( CipUdint aSessionHandle )
+{
+    unsigned ndx = aSessionHandle - 1;
+
+    if( ndx < UDIM( s_jobs ) && s_jobs[ndx] )
     {
-        CIPSTER_TRACE_ERR(
-            "%s: un-registered class in request path:'%s'\n",
-            __func__,
-            aRequest->Path().Format().c_str()
-            );
+        MrJob* job = s_jobs[ndx];
 
-        aResponse->SetGenStatus( kCipErrorPathDestinationUnknown );
-        return kEipStatusOkSend;
+        s_jobs[ndx] = NULL;
+
+        // A job still with a worker, or waiting for TakeFinished(), is
+        // deleted there.
+        if( job->done )
+            delete job;
+        else
+            job->session_handle = 0;
     }
+}
+
+#endif  // CIPSTER_MR_WORKERS
 
+
+/**
+ * Function route
+ * performs the service of @a aRequest on instance @a instance_id of
+ * @a clazz, which is the rest of NotifyMR() once the class is known.
+ * If @a aMayDefer and the service is thread safe, a worker may perform it.
+ */
+static EipStatus route( CipClass* clazz, int instance_id,
+        CipMessageRouterRequest* aRequest, CipMessageRouterResponse* aResponse,
+        bool aMayDefer )
+{
     // The conformance tool wants to know about kCipErrorServiceNotSupported errors
     // before wanting to know about kCipErrorPathDestinationUnknown errors, so
     // the order of these next two if() tests is very important.
@@ -363,6 +633,17 @@ EipStatus CipMessageRouterClass::NotifyMR(
 
     CIPSTER_ASSERT( service->service_function );
 
+#if CIPSTER_MR_WORKERS
+    // Only a session's own request is deferred, it waits for the reply.
+    if( aMayDefer && service->IsThreadSafe() && !s_embedding &&
+        aResponse->CPF() && aResponse->CPF()->SessionHandle() )
+    {
+        return deferred( service, instance, aRequest, aResponse );
+    }
+#else
+    (void) aMayDefer;
+#endif
+
     EipStatus status = service->service_function( instance, aRequest, aResponse );
 
     CIPSTER_TRACE_ERR(
@@ -375,3 +656,218 @@ EipStatus CipMessageRouterClass::NotifyMR(
 
     return status;
 }
+
+
+struct RouteCall
+{
+    CipClass*                   clazz;
+    int                         instance_id;
+    CipMessageRouterRequest*    request;
+    CipMessageRouterResponse*   response;
+    EipStatus                   status;
+};
+
+
+static void route_call( void* aCall )
+{
+    RouteCall* c = (RouteCall*) aCall;
+
+    c->status = route( c->clazz, c->instance_id, c->request, c->response, false );
+}
+
+
+EipStatus CipMessageRouterClass::NotifyMR(
+        CipMessageRouterRequest* aRequest, CipMessageRouterResponse* aResponse )
+{
+    CIPSTER_TRACE_INFO( "%s: routing...\n", __func__ );
+
+    aResponse->SetService( aRequest->Service() );
+
+    CipClass* clazz = NULL;
+
+    int instance_id;
+
+    if( aRequest->Path().HasSymbol() )
+    {
+        // Per Rockwell Automation Publication 1756-PM020D-EN-P - June 2016:
+        // Symbol Class Id is 0x6b.  Forward this request to that class.
+        // This class is not implemented in CIPster stack, but can be added by
+        // an application using simple RegisterCipClass( CipClass* aClass );
+        // Instances of this class are tags.
+        // I have such an implementation in my application.
+
+        instance_id = 0;   // talk to class 0x6b instance 0
+
+        clazz = GetCipClass( 0x6b );
+    }
+    else if( aRequest->Path().HasInstance() )
+    {
+        instance_id = aRequest->Path().GetInstance();
+        clazz = GetCipClass( aRequest->Path().GetClass() );
+    }
+    else
+    {
+        CIPSTER_TRACE_WARN( "%s: no instance specified\n", __func__ );
+
+        // instance_id was not in the request
+        aResponse->SetGenStatus( kCipErrorPathDestinationUnknown );
+        return kEipStatusOkSend;
+    }
+
+    if( !clazz )
+    {
+        CIPSTER_TRACE_ERR(
+            "%s: un-registered class in request path:'%s'\n",
+            __func__,
+            aRequest->Path().Format().c_str()
+            );
+
+        aResponse->SetGenStatus( kCipErrorPathDestinationUnknown );
+        return kEipStatusOkSend;
+    }
+
+    switch( clazz->ClassId() )
+    {
+    // These objects are the I/O connections' and their data, which belong to
+    // the I/O thread when there is one.
+    case kCipAssemblyClass:
+    case kCipConnectionClass:
+    case kCipConnectionManagerClass:
+        {
+            RouteCall call = { clazz, instance_id, aRequest, aResponse, kEipStatusOk };
+
+            IoThreadCall( route_call, &call );
+
+            return call.status;
+        }
+
+    default:
+        return route( clazz, instance_id, aRequest, aResponse, true );
+    }
+}
+
+
+/// Reply data of the service currently being performed from within a
+/// Multiple Service Packet, since mmr_temp is taken by the packet's own reply.
+static std::vector<uint8_t> s_embedded_reply( CIPSTER_MESSAGE_DATA_REPLY_BUFFER );
+
+
+/// Notes for the life of one that NotifyMR() is performing an embedded service,
+/// which must reply at once, not from a worker.
+struct Embedding
+{
+#if CIPSTER_MR_WORKERS
+    Embedding()     { ++s_embedding; }
+    ~Embedding()    { --s_embedding; }
+#else
+    Embedding()     {}
+#endif
+};
+
+
+EipStatus CipMessageRouterClass::multiple_service_packet_service(
+        CipInstance* instance,
+        CipMessageRouterRequest* request,
+        CipMessageRouterResponse* response )
+{
+    // See Vol1 A-4.10, request data is a count of services, a table of their
+    // offsets, then the services.  Offsets are from the start of the count.
+    // The reply data has the same layout.
+    BufReader   packet = request->Data();
+    BufWriter   out    = response->Writer();
+
+    if( packet.size() < 2 )
+    {
+        response->SetGenStatus( kCipErrorNotEnoughData );
+        return kEipStatusOkSend;
+    }
+
+    unsigned count = BufReader( packet ).get16();
+
+    unsigned table_end = 2 + 2 * count;
+
+    if( !count || table_end > packet.size() )
+    {
+        response->SetGenStatus( kCipErrorNotEnoughData );
+        return kEipStatusOkSend;
+    }
+
+    if( table_end > out.capacity() )
+    {
+        response->SetGenStatus( kCipErrorReplyDataTooLarge );
+        return kEipStatusOkSend;
+    }
+
+    BufReader   offsets = packet + 2;
+    BufWriter   table   = out + 2;
+    unsigned    at      = table_end;    // where the next reply goes in out
+    bool        failed  = false;
+
+    unsigned    begin   = offsets.get16();
+
+    for( unsigned i = 0;  i < count;  ++i )
+    {
+        unsigned end = i + 1 < count ? offsets.get16() : packet.size();
+
+        if( begin < table_end || begin >= end || end > packet.size() )
+        {
+            CIPSTER_TRACE_ERR( "%s: bad offset for service %u\n", __func__, i );
+            response->SetGenStatus( kCipErrorInvalidParameter );
+            return kEipStatusOkSend;
+        }
+
+        CipMessageRouterRequest     embedded;
+        Embedding                   embedding;
+        CipMessageRouterResponse    reply( response->CPF(),
+            BufWriter( s_embedded_reply.data(), s_embedded_reply.size() ) );
+
+        int consumed = embedded.DeserializeMRReq(
+                            BufReader( packet.data() + begin, end - begin ) );
+
+        if( consumed <= 0 )
+        {
+            reply.SetService( CIPServiceCode( packet.data()[begin] & 0x7f ) );
+            reply.SetGenStatus( kCipErrorPathSegmentError );
+        }
+        else if( embedded.Service() == kMultipleServicePacket )
+        {
+            // one may not be nested in another, and s_embedded_reply is in use.
+            reply.SetService( kMultipleServicePacket );
+            reply.SetGenStatus( kCipErrorServiceNotSupported );
+        }
+        else if( NotifyMR( &embedded, &reply ) == kEipStatusError )
+        {
+            // A standalone request would get no reply, but this one's slot
+            // in the table must still be filled.
+            reply.SetGenStatus( kCipErrorGeneralError );
+            reply.SetWrittenSize( 0 );
+        }
+
+        if( reply.GenStatus() != kCipErrorSuccess )
+            failed = true;
+
+        int replyz = reply.SerializedCount();
+
+        if( at + replyz > out.capacity() )
+        {
+            CIPSTER_TRACE_ERR( "%s: reply to service %u does not fit\n", __func__, i );
+            response->SetGenStatus( kCipErrorReplyDataTooLarge );
+            return kEipStatusOkSend;
+        }
+
+        table.put16( at );
+        reply.Serialize( out + at );
+
+        at += replyz;
+        begin = end;
+    }
+
+    out.put16( count );
+
+    response->SetWrittenSize( at );
+
+    if( failed )
+        response->SetGenStatus( kCipErrorEmbeddedServiceError );
+
+    return kEipStatusOkSend;
+}
@@ -13,6 +13,18 @@
 #include "cipcommon.h"
 
 
+/**
+ * The count of worker threads which perform the services marked with
+ * CipService::SetThreadSafe(), so that requests on different sessions can be
+ * served in parallel.  Zero performs every service on the thread calling
+ * NetworkHandlerProcessOnce().  Only application classes mark services so,
+ * the stack's own always run on that thread.
+ */
+#if !defined(CIPSTER_MR_WORKERS)
+ #define CIPSTER_MR_WORKERS             0
+#endif
+
+
 /**
  * Struct CipMessageRouterRequest
  * See Vol1 - 2-4.1
@@ -130,6 +142,8 @@ public:
 
     int AdditionalStsCount() const  { return size_of_additional_status; }
 
+    CipUint AdditionalSts( int aIndex ) const   { return additional_status[aIndex]; }
+
     ConnMgrStatus ExtStatus() const
     {
         return ConnMgrStatus( size_of_additional_status ? additional_status[ 0 ] : 0 );
@@ -228,10 +242,39 @@ public:
      * @return EipStatus - kEipStatusError if error and caller is not to send any reply.
      *                     kEipStatusOkSend if caller is to send reply, which may contain
      *                      an error indication in general status field.
+     *                     kEipStatusPending if a worker thread is performing
+     *                      the service, then the session's next call with the
+     *                      same request, once TakeFinished() has returned that
+     *                      session, gives the worker's reply.
      */
     static EipStatus NotifyMR(  CipMessageRouterRequest*  aRequest,
                                 CipMessageRouterResponse* aResponse );
 
+#if CIPSTER_MR_WORKERS
+    /**
+     * Function StartWorkers
+     * starts the CIPSTER_MR_WORKERS threads performing thread safe services,
+     * each of which adds one to eventfd @a aDoneFd as it finishes one.
+     */
+    static EipStatus StartWorkers( int aDoneFd );
+
+    /// Stop and join the worker threads, dropping any unfinished services.
+    static void StopWorkers();
+
+    /**
+     * Function TakeFinished
+     * returns the handle of a session whose service a worker has finished,
+     * so its request can be given to NotifyMR() again, or 0 if none is left.
+     */
+    static CipUdint TakeFinished();
+
+    /**
+     * Function ForgetSession
+     * drops any service being performed for @a aSessionHandle, which closed.
+     */
+    static void ForgetSession( CipUdint aSessionHandle );
+#endif
+
     /**
      * Function Init
      * initializes the message router support.
@@ -241,6 +284,13 @@ public:
 
     CipInstance* CreateInstance( int aInstanceId );
 
+    /**
+     * Function multiple_service_packet_service
+     * performs each service request embedded in a Multiple Service Packet
+     * through NotifyMR(), and replies with all of their replies together, with
+     * kCipErrorEmbeddedServiceError if any of them failed.  If all the replies
+     * do not fit, the only reply is kCipErrorReplyDataTooLarge.
+     */
     static EipStatus multiple_service_packet_service( CipInstance* instance,
         CipMessageRouterRequest*  request,
         CipMessageRouterResponse* response );
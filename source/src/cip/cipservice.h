@@ -80,7 +80,8 @@ public:
             CipServiceFunction aServiceFunction ) :
         service_name( aServiceName ),
         service_id( aServiceId ),
-        service_function( aServiceFunction )
+        service_function( aServiceFunction ),
+        thread_safe( false )
     {
         // replies often or in 0x80 to service code, so stay below
         CIPSTER_ASSERT( aServiceId > 0 && aServiceId < 0x80 );
@@ -92,11 +93,27 @@ public:
 
     const std::string& ServiceName() const  { return service_name; }
 
+    /**
+     * Function SetThreadSafe
+     * tells that service_function may be called on a worker thread, alongside
+     * other services and the network handler, so NotifyMR() can hand it to one
+     * when CIPSTER_MR_WORKERS is non-zero.  It is then given a response with
+     * no CPF() and must not touch any stack state which is not its own.
+     */
+    CipService* SetThreadSafe( bool isThreadSafe = true )
+    {
+        thread_safe = isThreadSafe;
+        return this;
+    }
+
+    bool IsThreadSafe() const               { return thread_safe; }
+
     CipServiceFunction  service_function;
 
 protected:
     std::string         service_name;
     int                 service_id;
+    bool                thread_safe;
 };
 
 typedef std::vector<CipService*>       CipServices;
@@ -272,6 +272,21 @@ inline EipStatus ManageConnections()
  */
 EipStatus TriggerConnections( int output_assembly_id, int input_assembly_id );
 
+/** @ingroup CIP_API
+ * Function NotifyAssemblyChanged
+ * tells the stack that the application has changed input assembly
+ * @a aInputAssembly, so each change of state or application triggered
+ * connection producing it produces at the earliest time its production
+ * inhibit timer allows.  Unlike TriggerConnections() this may be called from
+ * any thread, even a signal handler, since it only sets a flag with a lock-free
+ * atomic operation and writes an eventfd, which wakes
+ * NetworkHandlerProcessOnce() at once.  Without epoll the flag is taken at
+ * the next tick.
+ *
+ * @return kEipStatusOk, or kEipStatusError if the id exceeds 16 bits.
+ */
+EipStatus NotifyAssemblyChanged( int aInputAssembly );
+
 
 /**  @defgroup CIP_CALLBACK_API Callback Functions Demanded by CIPster
  * @ingroup CIP_API
@@ -327,6 +342,9 @@ void NotifyIoConnectionEvent( CipConn* aConn, IoConnectionEvent aEvent );
  * The CIP-stack uses this function to inform on received configuration data.
  * The length of the data is already checked within the stack. Therefore the
  * user only has to check if the data is valid.
+ *
+ * Not called for an assembly given an AssemblyInstance::InPlaceConsumer,
+ * which gets the received data instead of it being copied into the assembly.
  */
 EipStatus AfterAssemblyDataReceived( AssemblyInstance* aInstance,
     OpMode aMode, int aBytesReceivedCount );
@@ -338,7 +356,9 @@ EipStatus AfterAssemblyDataReceived( AssemblyInstance* aInstance,
  *
  * Within this function the user can update the data of the assembly object
  * before it gets sent. The application can inform the stack if data has
- * changed.  Use AssemblyInstance::Buffer() and SizeBytes().
+ * changed.  Use AssemblyInstance::Buffer() and SizeBytes().  A triple
+ * buffered assembly is instead written from any one application thread with
+ * AssemblyInstance::ImageToWrite() and PublishImage().
  * @param aInstance is the assembly instance that should send data.
  *
  * @return data has changed:
@@ -518,7 +538,7 @@ inline bool CloseSession( int aSocket )
  *   - Receive implicit connected data on a receiving UDP socket\n
  *     The received data has to be hand over to the Connection Manager Object
  *     with the function EipStatus RecvConnectedData( UdpSocket* aSocket,
- *      const SockAddr& aFromAddress, BufReader aCommand );
+ *      const SockAddr& aFromAddress, BufReader aCommand, const RxStamp& aStamp );
  *   - Close UDP and TCP sockets:
  *      -# Requested by CIPster through the call back function: void
  * CloseSocket(int aSocket)
@@ -93,6 +93,9 @@ int Cpf::NotifyCommonPacketFormat( BufReader aCommand, BufWriter aReply )
             {
                 EipStatus s = CipMessageRouterClass::NotifyMR( &request, &response );
 
+                if( s == kEipStatusPending )
+                    return kEncapReplyPending;
+
                 if( s == kEipStatusError )
                     return -kEncapErrorIncorrectData;
             }
@@ -122,6 +125,62 @@ int Cpf::NotifyCommonPacketFormat( BufReader aCommand, BufWriter aReply )
 }
 
 
+/// A class 3 request's use of its connection, which is done by IoThreadCall()
+/// since the connections belong to the I/O thread when there is one.
+struct Class3Call
+{
+    CipUdint    consuming_id;
+    bool        has_seq;
+    uint16_t    seq;
+    BufWriter   reply;
+
+    CipConn*    conn;           // found by class3_begin()
+    CipUdint    producing_id;
+    int         replayed;       // size of a cached reply put into reply
+    int         reply_size;     // of the fresh reply, for class3_end()
+};
+
+
+static void class3_begin( void* aCall )
+{
+    Class3Call* c = (Class3Call*) aCall;
+
+    c->conn = GetConnectionByConsumingId( c->consuming_id );
+    c->replayed = 0;
+
+    if( !c->conn )
+        return;
+
+    // reset the watchdog timer
+    c->conn->SetInactivityWatchDogTimerUSecs( c->conn->RxTimeoutUSecs() );
+
+    c->producing_id = c->conn->ProducingConnectionId();
+
+    if( c->has_seq )
+    {
+        // A retransmitted request, maybe a Set, must not be performed
+        // twice.  Give it the reply it got the first time.
+        BufReader cached = c->conn->Class3Reply( c->seq );
+
+        if( cached.size() )
+        {
+            c->reply.append( cached );
+            c->replayed = cached.size();
+        }
+    }
+}
+
+
+static void class3_end( void* aCall )
+{
+    Class3Call* c = (Class3Call*) aCall;
+
+    // unless the connection was closed while the request was performed
+    if( GetConnectionByConsumingId( c->consuming_id ) == c->conn )
+        c->conn->SetClass3Reply( c->seq, BufReader( c->reply.data(), c->reply_size ) );
+}
+
+
 int Cpf::NotifyConnectedCommonPacketFormat( BufReader aCommand, BufWriter aReply )
 {
     try
@@ -141,20 +200,34 @@ int Cpf::NotifyConnectedCommonPacketFormat( BufReader aCommand, BufWriter aReply
         }
 
         // ConnectedAddressItem item
-        CipConn* conn = GetConnectionByConsumingId( address_item.connection_identifier );
+        Class3Call  call;
+
+        call.consuming_id = address_item.connection_identifier;
+        call.has_seq = DataType() == kCpfIdConnectedDataItem;
+        call.reply = aReply;
+
+        BufReader   command( DataItemPayload() );
 
-        if( conn )
+        if( call.has_seq )
         {
-            // reset the watchdog timer
-            conn->SetInactivityWatchDogTimerUSecs( conn->RxTimeoutUSecs() );
+            address_item.encap_sequence_number = command.get16();
+            call.seq = address_item.encap_sequence_number;
+        }
+
+        IoThreadCall( class3_begin, &call );
 
-            // TODO check connection id  and sequence count
-            if( DataType() == kCpfIdConnectedDataItem )
+        if( call.conn )
+        {
+            // TODO check connection id
+            if( call.has_seq )
             {
-                // connected data item received
-                BufReader   command( DataItemPayload() );
+                if( call.replayed )
+                {
+                    CIPSTER_TRACE_INFO( "%s: replaying reply to sequence count %d\n",
+                            __func__, call.seq );
 
-                address_item.encap_sequence_number = command.get16();
+                    return call.replayed;
+                }
 
                 CipMessageRouterResponse response( this );  // give Cpf to response
                 CipMessageRouterRequest  request;
@@ -171,15 +244,22 @@ int Cpf::NotifyConnectedCommonPacketFormat( BufReader aCommand, BufWriter aReply
                 {
                     EipStatus s = CipMessageRouterClass::NotifyMR( &request, &response );
 
+                    if( s == kEipStatusPending )
+                        return kEncapReplyPending;
+
                     if( s == kEipStatusError )
                         return -kEncapErrorIncorrectData;
 
-                    address_item.connection_identifier = conn->ProducingConnectionId();
+                    address_item.connection_identifier = call.producing_id;
                 }
 
                 SetPayload( &response );
 
                 result = Serialize( aReply );  // this Cpf
+
+                call.reply_size = result;
+
+                IoThreadCall( class3_end, &call );
             }
             else
             {
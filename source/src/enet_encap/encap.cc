@@ -46,7 +46,7 @@ struct DelayedMsg
         message_size( 0 )
     {}
 
-    int32_t     time_out_usecs;     // must be signed 32 bits
+    uint32_t    deadline_usecs;     // absolute, compare to CurrentUSecs32()
     int         socket;
     SockAddr    receiver;
     uint8_t     message[ENCAP_MAX_DELAYED_ENCAP_MESSAGE_SIZE];
@@ -57,6 +57,12 @@ struct DelayedMsg
         return BufReader( message, message_size );
     }
 
+    /// Return the usecs remaining until this message is to be sent.
+    int32_t TimeoutUSecs() const
+    {
+        return deadline_usecs - CurrentUSecs32();
+    }
+
     static DelayedMsg messages[ENCAP_NUMBER_OF_SUPPORTED_DELAYED_ENCAP_MESSAGES];
 };
 
@@ -109,6 +115,13 @@ EncapError SessionMgr::RegisterTcpConnection( int aSocket, CipUdint* aSessionHan
 
     EncapSession& ses = sessions[index];
 
+    ses.m_buf = MsgBufPool::Alloc();
+
+    if( !ses.m_buf )
+    {
+        return kEncapErrorInsufficientMemory;
+    }
+
     ses.m_socket = aSocket;
 
     // Fetch IP address of other end of this TCP connection and save
@@ -123,6 +136,7 @@ EncapError SessionMgr::RegisterTcpConnection( int aSocket, CipUdint* aSessionHan
     {
         CIPSTER_TRACE_ERR( "%s[%d]: errno for peername(): '%s'\n",
                 __func__, aSocket, strerrno().c_str() );
+        ses.Clear();
         return kEncapErrorIncorrectData;
     }
     else
@@ -203,6 +217,18 @@ EncapSession* SessionMgr::UpdateRegisteredTcpConnection( int aSocket )
 }
 
 
+EncapSession* SessionMgr::GetSessionBySocket( int aSocket )
+{
+    for( int index = 0; index < DIM(sessions); ++index )
+    {
+        if( sessions[index].m_socket == aSocket )
+            return &sessions[index];
+    }
+
+    return NULL;
+}
+
+
 EncapSession* SessionMgr::CheckRegisteredSession(
         CipUdint aSessionHandle, int aSocket )
 {
@@ -309,7 +335,7 @@ void SessionMgr::AgeInactivity()
                 if( it->m_is_registered )
                 {
                     // close any class3 connections associated with this TCP socket.
-                    CipUdint session_handle = (it - sessions) + 1;
+                    CipUdint session_handle = SessionHandle( it );
 
                     CipConnMgrClass::CloseClass3Connections( session_handle );
                 }
@@ -336,6 +362,17 @@ void SessionMgr::Shutdown()
     }
 }
 
+void EncapSession::Close()
+{
+#if CIPSTER_MR_WORKERS
+    // a worker may still have this session's request
+    CipMessageRouterClass::ForgetSession( SessionMgr::SessionHandle( this ) );
+#endif
+
+    CloseSocket( m_socket );
+    Clear();
+}
+
 //-----<Encapsulation>----------------------------------------------------------
 
 
@@ -377,159 +414,94 @@ void Encapsulation::ShutDown()
 }
 
 
-int Encapsulation::EnsuredTcpRecv( int aSocket, uint8_t* aDest, int aByteCount )
-{
-    int i;
-    int numRead;
-
-    for( i=0;  i < aByteCount;  i += numRead )
-    {
-        numRead = recv( aSocket, (char*) aDest+i, aByteCount - i, 0 );
-        if( numRead == 0 )
-            break;
-
-        else if( numRead == -1 )
-        {
-            i = -1;
-            break;
-        }
-    }
-
-    return i;
-}
-
-
-/**
- * Function disposeOfLargePacket
- *
- * @return int - >  0 : number of bytes read.
- *             - == 0 : socket close on other end.
- *             - <  0 : error of some kind.
- */
-static int disposeOfLargePacket( int aSocket, unsigned aCount )
-{
-    uint8_t chunk[256];
-    int     total = 0;
-
-    CIPSTER_TRACE_INFO( "%s[%d]: count:%d\n", __func__, aSocket, aCount );
-
-    while( aCount )
-    {
-        // toss in chunks.
-        int readz = std::min( aCount, unsigned( sizeof chunk ) );
-
-        int num_read = Encapsulation::EnsuredTcpRecv( aSocket, chunk, readz );
-
-        if( num_read != readz )
-        {
-            return num_read;
-        }
-
-#if defined(DEBUG) && 0
-        byte_dump( "bigTCP", chunk, num_read );
-#endif
-        total  += num_read;
-        aCount -= num_read;
-    }
-
-    //CIPSTER_TRACE_INFO( "~%s\n", __func__ );
-
-    return total;
-}
-
-
-int Encapsulation::ReceiveTcpMsg( int aSocket, BufWriter aMsg )
+int Encapsulation::ReceiveTcpData( EncapSession* aSession )
 {
-    uint8_t* start = aMsg.data();
+    int socket = aSession->m_socket;
+    int room   = MsgBufPool::kBufSize - aSession->m_rx_count;
 
-    CIPSTER_TRACE_INFO( "%s[%d]:\n", __func__, aSocket );
-
-    if( aMsg.capacity() < ENCAPSULATION_HEADER_LENGTH )
-    {
-        CIPSTER_TRACE_ERR( "%s[%d]: aMsg size is too small\n", __func__, aSocket );
-        return kEipStatusError;
-    }
+    // TcpMsgLength() guarantees a whole message fits, so a full buffer
+    // holds one, and reading waits until it has been consumed.
+    if( room <= 0 )
+        return 0;
 
-    int num_read = EnsuredTcpRecv( aSocket, aMsg.data(), ENCAPSULATION_HEADER_LENGTH );
+    int num_read = recv( socket, (char*) aSession->m_buf + aSession->m_rx_count,
+                        room, 0 );
 
     if( num_read == 0 )
     {
         CIPSTER_TRACE_ERR( "%s[%d]: other end of socket closed by client\n",
-                __func__, aSocket );
+                __func__, socket );
         return kEipStatusError;
     }
 
-    if( num_read < ENCAPSULATION_HEADER_LENGTH )
+    if( num_read < 0 )
     {
+#if defined(_WIN32)
+        if( WSAGetLastError() == WSAEWOULDBLOCK )
+#else
+        if( errno == EAGAIN || errno == EWOULDBLOCK )
+#endif
+            return 0;
+
         CIPSTER_TRACE_ERR( "%s[%d]: recv() error: %s\n",
-                __func__, aSocket, strerror(errno) );
+                __func__, socket, strerrno().c_str() );
         return kEipStatusError;
     }
 
-    unsigned remaining = start[2] | (start[3] << 8);
+    aSession->m_rx_count += num_read;
+
+    CIPSTER_TRACE_INFO( "%s[%d]: received %d TCP bytes, %d buffered\n",
+            __func__, socket, num_read, aSession->m_rx_count );
+
+    return num_read;
+}
 
-    // advance BufWriter's pointer
-    aMsg += ENCAPSULATION_HEADER_LENGTH;
 
-    if( remaining > aMsg.capacity() )
+int Encapsulation::TcpMsgLength( const uint8_t* aBytes, int aCount )
+{
+    if( aCount < ENCAPSULATION_HEADER_LENGTH )
+        return 0;
+
+    unsigned remaining = aBytes[2] | (aBytes[3] << 8);
+
+    if( remaining > MsgBufPool::kBufSize - ENCAPSULATION_HEADER_LENGTH )
     {
         if( remaining > 65511 )
         {
             CIPSTER_TRACE_ERR(
-                "%s[%d]: illegal encapsulation data size:%d\n"
+                "%s: illegal encapsulation data size:%d\n"
                 " possibly out of sync, closing TCP connection\n",
-                __func__, aSocket, remaining );
-            return kEipStatusError;
+                __func__, remaining );
         }
-
+        else
+        {
 #if defined(DEBUG)
-        byte_dump( "rHDR", start, ENCAPSULATION_HEADER_LENGTH );
+            byte_dump( "rHDR", (uint8_t*) aBytes, ENCAPSULATION_HEADER_LENGTH );
 #endif
+            CIPSTER_TRACE_ERR(
+                "%s: packet len=%u is too big for #defined CIPSTER_ETHERNET_BUFFER_SIZE,\n"
+                "closing TCP connection on Encap.command='%s'\n",
+                __func__, remaining + ENCAPSULATION_HEADER_LENGTH,
+                ShowEncapCmd( aBytes[0] | (aBytes[1] << 8) )
+                );
+        }
 
-        CIPSTER_TRACE_ERR(
-            "%s[%d]: packet len=%u is too big for #defined CIPSTER_ETHERNET_BUFFER_SIZE,\n"
-            "ignoring entire packet with Encap.command='%s'\n",
-            __func__, aSocket, remaining + ENCAPSULATION_HEADER_LENGTH,
-            ShowEncapCmd( start[0] | (start[1] << 8) )
-            );
-
-        disposeOfLargePacket( aSocket, remaining );
-
-        // Do not report a full packet length here.
-        // The body was discarded, so this packet must not be parsed.
-        return kEipStatusError;
-    }
-
-    num_read = EnsuredTcpRecv( aSocket, aMsg.data(), remaining );
-
-    if( num_read < 0 )
-    {
-        CIPSTER_TRACE_ERR( "%s[%d]: error on recv: %s\n",
-                __func__, aSocket, strerror(errno) );
         return kEipStatusError;
     }
 
-    if( num_read < remaining )      // connection closed by client
-    {
-        CIPSTER_TRACE_ERR( "%s[%d]: connection closed by client: %s\n",
-                __func__, aSocket, strerror(errno) );
-        return kEipStatusError;
-    }
+    int length = ENCAPSULATION_HEADER_LENGTH + remaining;
 
-    num_read += ENCAPSULATION_HEADER_LENGTH;
+    if( aCount < length )
+        return 0;
 
 #if defined(DEBUG)
-    byte_dump( "rTCP", start, num_read );
+    byte_dump( "rTCP", (uint8_t*) aBytes, length );
 #endif
 
-    (void) start;
-
-    CIPSTER_TRACE_INFO( "%s[%d]: received %d TCP bytes, command:'%s'\n",
-            __func__, aSocket, num_read,
-            ShowEncapCmd( start[0] | (start[1] << 8) )
-            );
+    CIPSTER_TRACE_INFO( "%s: %d byte message, command:'%s'\n",
+            __func__, length, ShowEncapCmd( aBytes[0] | (aBytes[1] << 8) ) );
 
-    return num_read;
+    return length;
 }
 
 
@@ -673,7 +645,7 @@ int Encapsulation::handleReceivedListIdentityCommandDelayed(
         delayed->socket   = aSocket;
         delayed->receiver = aFromAddress;
 
-        delayed->time_out_usecs = aMSecDelay * 1000;
+        delayed->deadline_usecs = CurrentUSecs32() + aMSecDelay * 1000;
 
         BufWriter out( delayed->message, sizeof delayed->message );
 
@@ -855,6 +827,9 @@ int Encapsulation::HandleReceivedExplicitTcpData( int aSocket,
                             reply       // past encap header (headerz)
                             );
 
+                if( result == kEncapReplyPending )
+                    return result;
+
                 if( result < 0 )
                 {
                     encap.SetStatus( -result );
@@ -888,6 +863,9 @@ int Encapsulation::HandleReceivedExplicitTcpData( int aSocket,
                             command,    // past encap header
                             reply       // past encap header
                             );
+
+                if( result == kEncapReplyPending )
+                    return result;
             }
             else    // received a packet with non registered session handle
             {
@@ -1154,9 +1132,7 @@ void ManageEncapsulationMessages()
     {
         if( kSocketInvalid != DelayedMsg::messages[i].socket )
         {
-            DelayedMsg::messages[i].time_out_usecs -= kCIPsterTimerTickInMicroSeconds;
-
-            if( DelayedMsg::messages[i].time_out_usecs < 0 )
+            if( DelayedMsg::messages[i].TimeoutUSecs() <= 0 )
             {
                 // If delay is reached or passed, send the UDP message
                 SendUdpData( DelayedMsg::messages[i].receiver,
@@ -1168,3 +1144,22 @@ void ManageEncapsulationMessages()
         }
     }
 }
+
+
+int32_t NextEncapsulationMessageUSecs( int32_t aLimit )
+{
+    int32_t next = aLimit;
+
+    for( int i = 0; i < DIM( DelayedMsg::messages );  ++i )
+    {
+        if( kSocketInvalid != DelayedMsg::messages[i].socket )
+        {
+            int32_t remaining = DelayedMsg::messages[i].TimeoutUSecs();
+
+            if( remaining < next )
+                next = remaining;
+        }
+    }
+
+    return next;
+}
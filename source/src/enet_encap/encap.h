@@ -7,6 +7,9 @@
 #define CIPSTER_ENCAP_H_
 
 //#include <string>
+#include <string.h>
+#include <vector>
+
 #include "networkhandler.h"
 #include "typedefs.h"
 #include "../cip/cipcommon.h"
@@ -25,6 +28,10 @@
 
 const int kSupportedProtocolVersion = 1;        ///< Supported Encapsulation protocol version
 
+/// What HandleReceivedExplicitTcpData() returns when a worker has the request,
+/// see CIPSTER_MR_WORKERS.  The message is to be handled again once it finishes.
+const int kEncapReplyPending = -0x10000;
+
 
 /// Ethernet/IP standard port (44818) that all Ethernet/IP devices must support.
 const int kEIP_Reserved_Port        = 0xAF12;
@@ -62,6 +69,8 @@ enum EncapCmd
 };
 
 
+class EncapSession;
+
 /**
  * Class Encapsulation
  * helps with the Ethernet/IP encapsulation protocol, its header, and its state.
@@ -106,24 +115,28 @@ public:
     static void ShutDown();
 
     /**
-     * Function EnsuredTcpRecv
-     * may be called using a blocking TCP socket to read a certain number of bytes.
-     * It will block until requested byte count is received or it will return
-     * something other than the requested count if there is an error or the other
-     * end of the TCP connection closes its socket.
-     * @return int - the requested number of bytes or 0 if the other end closes or -1 if error.
+     * Function ReceiveTcpData
+     * reads whatever has arrived on a non-blocking TCP socket, as much as
+     * fits, onto the end of @a aSession's buffer.  That may be part of one
+     * Encapsulation message or several whole ones, TcpMsgLength() tells.
+     *
+     * @param aSession is the TCP connection, whose socket is known to be readable.
+     * @return int - the number of bytes added to the buffer, 0 if none were
+     *    available, or kEipStatusError (-1) if the connection closed or failed.
      */
-    static int EnsuredTcpRecv( int aSocket, uint8_t* aDest, int aByteCount );
+    static int ReceiveTcpData( EncapSession* aSession );
 
     /**
-     * Function ReceiveTcpMsg
-     * reads an Encapsulation message in from a TCP socket into caller's aMessage buffer.
-     * @param aSocket is the open socket to read from, data is known to be available.
-     * @param aMessage is where to put the Encapsulation header and payload.
-     * @return int - the number of bytes in the total message or
-     *    kEipStatusError (-1) if error.
+     * Function TcpMsgLength
+     * tells if @a aBytes begins with a whole Encapsulation message.
+     *
+     * @param aBytes is received TCP data starting on a message boundary.
+     * @param aCount is the number of bytes in @a aBytes.
+     * @return int - the length of that message, 0 if more bytes are needed,
+     *    or kEipStatusError (-1) if its length would not fit in a MsgBufPool
+     *    buffer, which leaves the connection out of sync.
      */
-    static int ReceiveTcpMsg( int aSocket, BufWriter aMessage );
+    static int TcpMsgLength( const uint8_t* aBytes, int aCount );
 
     /**
      * Function HandleReceivedExplicitUdpData
@@ -149,7 +162,8 @@ public:
      * @param aSocket the BSD socket from which data is received.
      * @param aCommand is the buffer that contains the received data.
      * @param aReply is the buffer that should be used for the reply.
-     * @return int - byte count of reply that needs to be sent back, or -1 if error
+     * @return int - byte count of reply that needs to be sent back, or -1 if error,
+     *  or kEncapReplyPending if a message router worker has the request.
      */
     static int HandleReceivedExplicitTcpData( int aSocket,
                     BufReader aCommand, BufWriter aReply );
@@ -308,6 +322,64 @@ public:
 };
 
 
+/**
+ * Class TxQueue
+ * holds the reply bytes a TCP socket has not yet taken.  They are appended
+ * at the end and taken from the head, so neither a partial send nor another
+ * reply moves the bytes between, and its storage is only zeroed as it grows.
+ */
+class TxQueue
+{
+public:
+    TxQueue() : head( 0 ), end( 0 ) {}
+
+    int Size() const                { return end - head; }
+    bool Empty() const              { return end == head; }
+
+    /// Return the first byte not yet taken, valid while not Empty().
+    const uint8_t* Head() const     { return &bytes[head]; }
+
+    /**
+     * Function Room
+     * returns where @a aCount more bytes may be written after the end,
+     * which Append() then adds to the queue.  Only when the storage is out
+     * of room are the bytes moved down over those taken, or is it grown.
+     */
+    uint8_t* Room( int aCount )
+    {
+        if( end + aCount > int( bytes.size() ) && head )
+        {
+            memmove( &bytes[0], &bytes[head], end - head );
+            end -= head;
+            head = 0;
+        }
+
+        if( end + aCount > int( bytes.size() ) )
+            bytes.resize( end + aCount );
+
+        return &bytes[end];
+    }
+
+    void Append( int aCount )       { end += aCount; }
+
+    /// Drop the first @a aCount bytes, once sent.
+    void Take( int aCount )
+    {
+        head += aCount;
+
+        if( head == end )
+            head = end = 0;
+    }
+
+    void Clear()                    { head = end = 0; }
+
+private:
+    std::vector<uint8_t>    bytes;
+    int         head;               // first byte not yet taken
+    int         end;                // just past the last byte appended
+};
+
+
 /**
  * Struct EncapSession
  * holds data for an Encapsulation Protocol Session, as well as
@@ -323,7 +395,8 @@ public:
  */
 struct EncapSession
 {
-    EncapSession()
+    EncapSession() :
+        m_buf( NULL )
     {
         Clear();
     }
@@ -334,13 +407,18 @@ struct EncapSession
         m_peeraddr.SetFamily( 0 );
         m_last_activity_usecs = 0;
         m_is_registered = false;
+        m_rx_count = 0;
+        m_tx_queue.Clear();
+        m_rx_held = false;
+        m_reading = true;
+        m_writing = false;
+        m_mr_pending = false;
+
+        MsgBufPool::Free( m_buf );
+        m_buf = NULL;
     }
 
-    void Close()
-    {
-        CloseSocket( m_socket );
-        Clear();
-    }
+    void Close();
 
     void NoteTcpActivity()
     {
@@ -354,6 +432,16 @@ struct EncapSession
 
     bool        m_is_registered;        // false => TCP connection only
                                         // true  => Registered ENIP Session
+
+    uint8_t*    m_buf;                  // from MsgBufPool, for messages and replies
+    int         m_rx_count;             // received bytes in m_buf not yet handled
+
+    TxQueue     m_tx_queue;             // replies the socket has not yet taken
+    bool        m_rx_held;              // m_buf waits for m_tx_queue to drain
+
+    bool        m_reading;              // event loop watches for readability
+    bool        m_writing;              // event loop watches for writability
+    bool        m_mr_pending;           // a message router worker has its request
 };
 
 
@@ -447,8 +535,14 @@ public:
      */
     static void AgeInactivity();
 
+    /**
+     * Function GetSessionBySocket
+     * @return EncapSession* - the TCP connection on @a aSocket, or NULL.
+     */
+    static EncapSession* GetSessionBySocket( int aSocket );
+
     /// inline for speed, translate aSessionHandle into an EncapSession pointer.
-    static const EncapSession* GetSession( CipUdint aSessionHandle )
+    static EncapSession* GetSession( CipUdint aSessionHandle )
     {
         unsigned ndx = aSessionHandle - 1;
 
@@ -458,6 +552,12 @@ public:
         return NULL;
     }
 
+    /// Translate @a aSession into its session handle.
+    static CipUdint SessionHandle( const EncapSession* aSession )
+    {
+        return ( aSession - sessions ) + 1;
+    }
+
 private:
 
     friend int inc_wrap( int index );
@@ -478,5 +578,15 @@ private:
  */
 void ManageEncapsulationMessages();
 
+/**
+ * Function NextEncapsulationMessageUSecs
+ * returns the number of usecs until the earliest delayed encapsulation
+ * message is due to be sent by ManageEncapsulationMessages().
+ *
+ * @param aLimit is returned if none is due sooner.
+ * @return int32_t - usecs relative to CurrentUSecs32(), <= 0 if already due.
+ */
+int32_t NextEncapsulationMessageUSecs( int32_t aLimit );
+
 
 #endif // CIPSTER_ENCAP_H_
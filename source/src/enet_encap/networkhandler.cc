@@ -12,12 +12,18 @@
 #include <string.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <algorithm>
 
 #if defined(__linux__)
  #include <unistd.h>
  #include <sys/time.h>
  #include <time.h>
  #include <sys/select.h>
+ #include <sched.h>
+ #include <pthread.h>
+ #include <sys/mman.h>
+ #include <sys/resource.h>
+ #include <malloc.h>
 #endif
 
 #if defined(__APPLE__)
@@ -36,31 +42,224 @@
 #include <trace.h>
 #include "encap.h"
 #include "cip/cipconnectionmanager.h"
+#include "cip/cipmessagerouter.h"
 #include "cip/ciptcpipinterface.h"
 
 
-/**
- * The number of bytes used for the Ethernet message buffer on
- * the PC port. For different platforms it may make sense to
- * have more than one buffer.
- *
- *  This buffer size will be used for any received message.
- *  The same buffer is used for the replied explicit message.
- */
-static uint8_t s_buf[CIPSTER_ETHERNET_BUFFER_SIZE];
-#define S_BUFZ                      sizeof(s_buf)
+/*  On Linux the socket readiness is taken from epoll, which returns only the
+    ready sockets together with a tagged pointer to their owner.  Define
+    CIPSTER_USE_SELECT in cipster_user_conf.h to force the portable select()
+    code path.
+*/
+#if defined(__linux__) && !defined(CIPSTER_USE_SELECT)
+ #define CIPSTER_USE_EPOLL          1
+ #include <sys/epoll.h>
+ #include <sys/timerfd.h>
+ #include <sys/eventfd.h>
+#endif
+
+#if defined(CIPSTER_WITH_IO_THREAD)
+ #if !defined(CIPSTER_USE_EPOLL)
+  #error CIPSTER_WITH_IO_THREAD needs epoll, i.e. Linux without CIPSTER_USE_SELECT
+ #endif
+ #include <pthread.h>
+ #include <exception>
+ #include "spsc_queue.h"
+#endif
+
+#if CIPSTER_MR_WORKERS
+ #if !defined(CIPSTER_USE_EPOLL)
+  #error CIPSTER_MR_WORKERS needs epoll, i.e. Linux without CIPSTER_USE_SELECT
+ #endif
+#endif
+
+/*  On Linux inbound UDP is drained in bursts with recvmmsg(), and the
+    I/O frames produced in one tick are sent together with sendmmsg(), one
+    kernel crossing for many I/O frames either way.  The kernel stamps each
+    inbound I/O frame with its arrival, by SO_TIMESTAMPNS.
+*/
+#if defined(__linux__)
+ #define CIPSTER_USE_RECVMMSG       1
+ #define CIPSTER_USE_SENDMMSG       1
+ #define CIPSTER_USE_RX_TIMESTAMPS  1
+ #include <sys/socket.h>
+ #include <sys/uio.h>
+#endif
+
+
+uint8_t     MsgBufPool::bufs[CIPSTER_NUM_MESSAGE_BUFFERS][kBufSize];
+uint8_t*    MsgBufPool::free_list[CIPSTER_NUM_MESSAGE_BUFFERS];
+int         MsgBufPool::free_count;
+bool        MsgBufPool::initialized;
+
+
+uint8_t* MsgBufPool::Alloc()
+{
+    if( !initialized )
+    {
+        for( int i = 0; i < CIPSTER_NUM_MESSAGE_BUFFERS;  ++i )
+            free_list[i] = bufs[i];
+
+        free_count = CIPSTER_NUM_MESSAGE_BUFFERS;
+        initialized = true;
+    }
+
+    if( !free_count )
+    {
+        CIPSTER_TRACE_WARN( "%s: all CIPSTER_NUM_MESSAGE_BUFFERS (= %d) in use\n",
+            __func__, CIPSTER_NUM_MESSAGE_BUFFERS );
+        return NULL;
+    }
+
+    return free_list[--free_count];
+}
+
+
+void MsgBufPool::Free( uint8_t* aBuf )
+{
+    if( aBuf )
+    {
+        CIPSTER_ASSERT( free_count < CIPSTER_NUM_MESSAGE_BUFFERS );
+        free_list[free_count++] = aBuf;
+    }
+}
+
+#define S_BUFZ                      MsgBufPool::kBufSize
+
+#if defined(CIPSTER_USE_RECVMMSG)
+
+// A burst of datagrams is taken from a UDP socket with one recvmmsg() call,
+// each into its own buffer from this ring.
+#define UDP_RX_BATCH                16
+
+static uint8_t          rx_bufs[UDP_RX_BATCH][CIPSTER_ETHERNET_BUFFER_SIZE];
+static sockaddr_in      rx_addrs[UDP_RX_BATCH];
+static struct iovec     rx_iovs[UDP_RX_BATCH];
+static struct mmsghdr   rx_msgs[UDP_RX_BATCH];
+
+#if defined(CIPSTER_USE_RX_TIMESTAMPS)
+// Where each datagram's SCM_TIMESTAMPNS goes, aligned for a cmsghdr.
+static union
+{
+    cmsghdr     align;
+    uint8_t     bytes[CMSG_SPACE( sizeof(timespec) )];
+}                       rx_ctrls[UDP_RX_BATCH];
+#endif
+
+#else
+
+// I/O datagrams are taken one at a time into this buffer from MsgBufPool.
+static uint8_t*         s_io_buf;
+
+#endif
+
+#if defined(CIPSTER_USE_SENDMMSG)
+
+// Datagrams held by UdpSocket::Send() between UdpTxBatchBegin() and
+// UdpTxBatchFlush(), each copied into its own buffer, or just pointed to
+// when given as a header and data pair.
+#define UDP_TX_BATCH                32
+
+struct UdpTxSlot
+{
+    UdpSocket*      udp;
+    int             socket;         // udp->h() when queued
+    sockaddr_in     addr;
+    struct iovec    iov[2];
+    int             iovcnt;
+    uint8_t         buf[CIPSTER_ETHERNET_BUFFER_SIZE];
+};
+
+static UdpTxSlot        tx_slots[UDP_TX_BATCH];
+static struct mmsghdr   tx_msgs[UDP_TX_BATCH];
+static int              tx_count;
+static bool             tx_batching;
+
+#endif
 
 #define MAX_NO_OF_TCP_SOCKETS       10
 
+#if defined(CIPSTER_USE_EPOLL)
+
+#define MAX_EPOLL_EVENTS            64
+
+static int epoll_fd = -1;
+
+// one shot timer ending a blocking epoll_wait() at the next stack deadline
+static int timer_fd = -1;
+
+// written by NotifyAssemblyChanged(), in the set of the thread which runs
+// ManageConnections()
+static int trigger_fd = -1;
+
+#if CIPSTER_MR_WORKERS
+// rung by a message router worker as it finishes each request
+static int mr_done_fd = -1;
+#endif
+
+#if defined(CIPSTER_WITH_IO_THREAD)
+
+/*  The I/O thread has its own epoll set and timer for the UDP sockets of I/O
+    connections, and runs ManageConnections().  The thread calling
+    NetworkHandlerProcessOnce(), called the explicit thread here, keeps the
+    set above for the listeners and the TCP connections.  Each thread is rung
+    by the other through an eventfd when there is a call for it to run.
+*/
+static int io_epoll_fd = -1;
+static int io_timer_fd = -1;
+static int io_wake_fd = -1;             // calls in io_calls, or stop
+static int io_done_fd = -1;             // one count per call run from io_calls
+static int explicit_wake_fd = -1;       // calls in explicit_calls
+
+struct ThreadCall
+{
+    void    (*func)( void* );
+    void*   arg;
+};
+
+// IoThreadCall() waits for each call, so one at a time is queued.
+static SpscQueue<ThreadCall,4>      io_calls;
+static SpscQueue<ThreadCall,64>     explicit_calls;
+
+// what a call run on the I/O thread threw, rethrown by IoThreadCall().
+static std::exception_ptr   io_call_error;
+static std::atomic<unsigned> io_calls_done;
+
+static pthread_t            io_thread;
+static bool                 io_thread_running;
+static std::atomic<bool>    io_thread_stop;
+
+// when tcp_inactivity_usecs was last advanced by the explicit thread
+static unsigned             explicit_last_usecs;
+
+#endif
+
+#else
+
 static fd_set master_set;
 static fd_set read_set;
 
+// TCP connections with a non-empty transmit queue
+static fd_set write_master_set;
+static fd_set write_set;
+
 // temporary file descriptor for select()
 static int highest_socket_handle;
 
+#endif
+
+#if defined(CIPSTER_WITH_IO_THREAD)
+std::atomic<uint64_t>   g_current_usecs;    // only the I/O thread stores
+#else
 uint64_t    g_current_usecs;
+#endif
 unsigned    s_last_usecs;       // only 32 needed bits here.
 
+// process AgeInactivity every 1/2 second.  This is fine because
+// CipTCPIPInterfaceInstance::inactivity_timeout_secs is in seconds so
+// respecting the timeout within 1/2 is sufficient.
+const unsigned INACTIVITY_CHECK_PERIOD_USECS = 500000;
+
 
 struct NetworkStatus
 {
@@ -68,8 +267,14 @@ struct NetworkStatus
     int         udp_unicast_listener;
     int         udp_local_broadcast_listener;
     int         udp_global_broadcast_listener;
-    unsigned    elapsed_time_usecs;
-    unsigned    tcp_inactivity_usecs;
+
+    // each encapsulation UDP socket receives into and replies from its own
+    uint8_t*    udp_unicast_buf;
+    uint8_t*    udp_local_broadcast_buf;
+    uint8_t*    udp_global_broadcast_buf;
+
+    unsigned    elapsed_time_usecs;     // I/O thread
+    unsigned    tcp_inactivity_usecs;   // explicit thread
 };
 
 
@@ -119,18 +324,71 @@ static unsigned usecs_now()
 }
 
 
-static void master_set_add( const char* aType, int aSocket )
+/**
+ * Enum EventTag
+ * is kept in the lowest 2 bits of an event cookie and tells what the
+ * remaining bits are: a listener's socket, a UdpSocket* or an EncapSession*.
+ * This lets a readiness event lead straight to its owner without scanning.
+ */
+enum EventTag
+{
+    kEventListener  = 0,
+    kEventUdp       = 1,
+    kEventSession   = 2,
+    kEventTagMask   = 3,
+};
+
+
+static uint64_t event_cookie( int aListener )
+{
+    return ( uint64_t( aListener ) << 2 ) | kEventListener;
+}
+
+
+static uint64_t event_cookie( const void* aOwner, EventTag aTag )
+{
+    // owners are at least 4 byte aligned, leaving room for the tag.
+    CIPSTER_ASSERT( !( uintptr_t( aOwner ) & kEventTagMask ) );
+
+    return uint64_t( uintptr_t( aOwner ) ) | aTag;
+}
+
+
+static void master_set_add( const char* aType, int aSocket, uint64_t aCookie )
 {
     CIPSTER_TRACE_INFO( "%s[%d]: %s socket\n", __func__, aSocket, aType );
 
     (void) aType;
 
+#if defined(CIPSTER_USE_EPOLL)
+    epoll_event ev;
+
+    ev.events   = EPOLLIN;
+    ev.data.u64 = aCookie;
+
+    int epfd = epoll_fd;
+
+#if defined(CIPSTER_WITH_IO_THREAD)
+    // I/O connections' UDP sockets are read by the I/O thread.
+    if( ( aCookie & kEventTagMask ) == kEventUdp && io_epoll_fd != -1 )
+        epfd = io_epoll_fd;
+#endif
+
+    if( epoll_ctl( epfd, EPOLL_CTL_ADD, aSocket, &ev ) )
+    {
+        CIPSTER_TRACE_ERR( "%s[%d]: epoll_ctl() errno:'%s'\n",
+            __func__, aSocket, strerrno().c_str() );
+    }
+#else
+    (void) aCookie;
+
     FD_SET( aSocket, &master_set );
 
     if( aSocket > highest_socket_handle )
     {
         highest_socket_handle = aSocket;
     }
+#endif
 }
 
 
@@ -139,12 +397,24 @@ static void master_set_rem( int aSocket )
     CIPSTER_ASSERT( aSocket >= 0 );
     CIPSTER_TRACE_INFO( "%s[%d]\n", __func__, aSocket );
 
+#if defined(CIPSTER_USE_EPOLL)
+    // A socket which was never added gives ENOENT here, that is harmless.
+    if( epoll_fd != -1 )
+        epoll_ctl( epoll_fd, EPOLL_CTL_DEL, aSocket, NULL );
+
+#if defined(CIPSTER_WITH_IO_THREAD)
+    if( io_epoll_fd != -1 )
+        epoll_ctl( io_epoll_fd, EPOLL_CTL_DEL, aSocket, NULL );
+#endif
+#else
     FD_CLR( aSocket, &master_set );
+    FD_CLR( aSocket, &write_master_set );
 
     if( aSocket == highest_socket_handle && aSocket > 0 )
     {
         --highest_socket_handle;
     }
+#endif
 }
 
 
@@ -186,6 +456,7 @@ void CloseSocket( int aSocket )
 }
 
 
+#if !defined(CIPSTER_USE_EPOLL)
 /**
  * Function checkSocketSet
  * checks if the given socket is set in 'read_set' and 'master_set'.
@@ -209,100 +480,101 @@ static bool checkSocketSet( int aSocket )
 
     return false;
 }
+#endif
 
 
-void CheckAndHandleUdpUnicastSocket()
+static void handleUdpUnicastSocket()
 {
     SockAddr    from_addr;
     socklen_t   from_addr_length;
 
-    // see if this is an unsolicited inbound UDP message
-    if( checkSocketSet( s_sockets.udp_unicast_listener ) )
-    {
-        from_addr_length = sizeof(from_addr);
+    from_addr_length = sizeof(from_addr);
 
-        CIPSTER_TRACE_STATE(
-                "%s[%d]: unsolicited UDP message on EIP unicast socket\n",
-                __func__, s_sockets.udp_unicast_listener );
+    CIPSTER_TRACE_STATE(
+            "%s[%d]: unsolicited UDP message on EIP unicast socket\n",
+            __func__, s_sockets.udp_unicast_listener );
 
-        // Handle UDP broadcast messages
-        int received_size = recvfrom( s_sockets.udp_unicast_listener,
-                (char*) s_buf, S_BUFZ,
-                0, from_addr,  &from_addr_length );
+    // Handle UDP broadcast messages
+    int received_size = recvfrom( s_sockets.udp_unicast_listener,
+            (char*) s_sockets.udp_unicast_buf, S_BUFZ,
+            0, from_addr,  &from_addr_length );
 
-        if( received_size <= 0 ) // got error
-        {
-            CIPSTER_TRACE_ERR(
-                    "%s[%d]: error on recvfrom UDP unicast socket: '%s'\n",
-                    __func__,
-                    s_sockets.udp_unicast_listener,
-                    strerrno().c_str() );
-            return;
-        }
+    if( received_size <= 0 ) // got error
+    {
+        CIPSTER_TRACE_ERR(
+                "%s[%d]: error on recvfrom UDP unicast socket: '%s'\n",
+                __func__,
+                s_sockets.udp_unicast_listener,
+                strerrno().c_str() );
+        return;
+    }
 
-        int reply_length = Encapsulation::HandleReceivedExplicitUdpData(
-                s_sockets.udp_unicast_listener, from_addr,
-                BufReader( s_buf, received_size ),
-                BufWriter( s_buf, S_BUFZ ), true );
+    int reply_length = Encapsulation::HandleReceivedExplicitUdpData(
+            s_sockets.udp_unicast_listener, from_addr,
+            BufReader( s_sockets.udp_unicast_buf, received_size ),
+            BufWriter( s_sockets.udp_unicast_buf, S_BUFZ ), true );
 
-        if( reply_length > 0 )
-        {
-            // if the active socket matches a registered UDP callback, handle a UDP packet
-            int sent_count = sendto( s_sockets.udp_unicast_listener,
-                        (char*) s_buf, reply_length, 0,
-                        from_addr, sizeof(from_addr) );
+    if( reply_length > 0 )
+    {
+        // if the active socket matches a registered UDP callback, handle a UDP packet
+        int sent_count = sendto( s_sockets.udp_unicast_listener,
+                    (char*) s_sockets.udp_unicast_buf, reply_length, 0,
+                    from_addr, sizeof(from_addr) );
 
-            CIPSTER_TRACE_INFO( "%s[%d]: sent %d reply bytes\n",
-                __func__, s_sockets.udp_unicast_listener,  sent_count );
+        CIPSTER_TRACE_INFO( "%s[%d]: sent %d reply bytes\n",
+            __func__, s_sockets.udp_unicast_listener,  sent_count );
 
-            if( sent_count != reply_length )
-            {
-                CIPSTER_TRACE_INFO(
-                        "%s[%d]: UDP unicast response was not fully sent\n",
-                        __func__, s_sockets.udp_unicast_listener );
-            }
+        if( sent_count != reply_length )
+        {
+            CIPSTER_TRACE_INFO(
+                    "%s[%d]: UDP unicast response was not fully sent\n",
+                    __func__, s_sockets.udp_unicast_listener );
         }
     }
 }
 
 
 /**
- * Function CheckAndHandlTcpListernetSocket
+ * Function handleTcpListenerSocket
  * handles any connection request coming in the TCP server socket.
  */
-void CheckAndHandleTcpListenerSocket()
+static void handleTcpListenerSocket()
 {
     int new_socket;
 
-    // see if this is a connection request to the dedicated "tcp_listener"
-    if( checkSocketSet( s_sockets.tcp_listener ) )
-    {
-        new_socket = accept( s_sockets.tcp_listener, NULL, NULL );
+    new_socket = accept( s_sockets.tcp_listener, NULL, NULL );
 
-        CIPSTER_TRACE_INFO( "%s[%d]: new TCP connection\n", __func__, new_socket );
+    CIPSTER_TRACE_INFO( "%s[%d]: new TCP connection\n", __func__, new_socket );
 
-        if( new_socket == kSocketInvalid )
-        {
-            CIPSTER_TRACE_ERR( "%s[%d]: error on accept: %s\n",
-                    __func__, s_sockets.tcp_listener, strerrno().c_str() );
-            return;
-        }
+    if( new_socket == kSocketInvalid )
+    {
+        CIPSTER_TRACE_ERR( "%s[%d]: error on accept: %s\n",
+                __func__, s_sockets.tcp_listener, strerrno().c_str() );
+        return;
+    }
 
-        EncapError result = SessionMgr::RegisterTcpConnection( new_socket );
+    CipUdint    session_handle;
 
-        if( result != kEncapErrorSuccess )
-        {
-            CIPSTER_TRACE_ERR(
-                "%s[%d]: rejecting incoming TCP connection since count exceeds\n"
-                " CIPSTER_NUMBER_OF_SUPPORTED_SESSIONS (= %d)\n",
-                __func__, new_socket,
-                CIPSTER_NUMBER_OF_SUPPORTED_SESSIONS
-                );
-            return;
-        }
+    EncapError result = SessionMgr::RegisterTcpConnection( new_socket, &session_handle );
 
-        master_set_add( "TCP", new_socket );
+    if( result != kEncapErrorSuccess )
+    {
+        CIPSTER_TRACE_ERR(
+            "%s[%d]: rejecting incoming TCP connection since count exceeds\n"
+            " CIPSTER_NUMBER_OF_SUPPORTED_SESSIONS (= %d) or no message buffer is free\n",
+            __func__, new_socket,
+            CIPSTER_NUMBER_OF_SUPPORTED_SESSIONS
+            );
+        CloseSocket( new_socket );
+        return;
     }
+
+    // Messages are framed from whatever has arrived by TcpMsgLength(), so
+    // a client sending part of one must not block the stack on recv().
+    SocketAsync( new_socket );
+
+    master_set_add( "TCP", new_socket, event_cookie(
+            SessionMgr::GetSession( session_handle ), kEventSession ) );
 }
 
 
@@ -318,126 +590,286 @@ void CheckAndHandleTcpListenerSocket()
 
 
 /**
- * Function CheckAndHandleUdpLocalBroadcastSocket
- * checks if data has been received on the UDP broadcast socket and if
- * yes handles it correctly.
+ * Function handleUdpLocalBroadcastSocket
+ * handles data which has been received on the UDP local broadcast socket.
  */
-void CheckAndHandleUdpLocalBroadcastSocket()
+static void handleUdpLocalBroadcastSocket()
 {
     SockAddr    from_addr;
     socklen_t   from_addr_length;
 
-    // see if this is an unsolicited inbound UDP message
-    if( checkSocketSet( s_sockets.udp_local_broadcast_listener ) )
+    from_addr_length = sizeof(from_addr);
+
+    CIPSTER_TRACE_STATE(
+        "%s[%d]: unsolicited UDP on local broadcast socket\n",
+        __func__,
+        s_sockets.udp_local_broadcast_listener
+        );
+
+    // Handle UDP broadcast messages
+    int received_size = recvfrom( s_sockets.udp_local_broadcast_listener,
+            (char*) s_sockets.udp_local_broadcast_buf,  S_BUFZ, 0,
+            from_addr, &from_addr_length );
+
+    if( received_size <= 0 ) // got error
+    {
+        CIPSTER_TRACE_ERR(
+                "%s[%d]: error on recvfrom UDP local broadcast socket: '%s'\n",
+                __func__,
+                s_sockets.udp_local_broadcast_listener,
+                strerrno().c_str() );
+        return;
+    }
+
+    int reply_length = Encapsulation::HandleReceivedExplicitUdpData(
+            s_sockets.udp_local_broadcast_listener, from_addr,
+            BufReader( s_sockets.udp_local_broadcast_buf, received_size ),
+            BufWriter( s_sockets.udp_local_broadcast_buf, S_BUFZ ), false );
+
+    if( reply_length > 0 )
     {
-        from_addr_length = sizeof(from_addr);
+        // if the active socket matches a registered UDP callback, handle a UDP packet
+        int sent_count = sendto( s_sockets.udp_local_broadcast_listener,
+                    (char*) s_sockets.udp_local_broadcast_buf, reply_length, 0,
+                    from_addr, sizeof(from_addr) );
+
+        CIPSTER_TRACE_INFO( "%s[%d]: sent %d reply bytes\n",
+            __func__, s_sockets.udp_local_broadcast_listener, sent_count );
+
+        if( sent_count != reply_length )
+        {
+            CIPSTER_TRACE_INFO(
+                "%s[%d]: UDP response was not fully sent\n",
+                __func__, s_sockets.udp_local_broadcast_listener );
+        }
+    }
+}
+
+
+static void handleUdpGlobalBroadcastSocket()
+{
+    SockAddr    from_addr;
+    socklen_t   from_addr_length;
 
-        CIPSTER_TRACE_STATE(
-            "%s[%d]: unsolicited UDP on local broadcast socket\n",
+    from_addr_length = sizeof(from_addr);
+
+    CIPSTER_TRACE_STATE(
+        "%s[%d]: unsolicited UDP on global broadcast socket\n",
+        __func__, s_sockets.udp_global_broadcast_listener );
+
+    // Handle UDP broadcast messages
+    int received_size = recvfrom( s_sockets.udp_global_broadcast_listener,
+            (char*) s_sockets.udp_global_broadcast_buf, S_BUFZ, 0,
+            from_addr, &from_addr_length );
+
+    if( received_size <= 0 ) // got error
+    {
+        CIPSTER_TRACE_ERR(
+            "%s[%d]: error on recvfrom UDP global broadcast socket: '%s'\n",
             __func__,
-            s_sockets.udp_local_broadcast_listener
-            );
+            s_sockets.udp_global_broadcast_listener,
+            strerrno().c_str() );
+
+        return;
+    }
 
-        // Handle UDP broadcast messages
-        int received_size = recvfrom( s_sockets.udp_local_broadcast_listener,
-                (char*) s_buf,  S_BUFZ, 0,
-                from_addr, &from_addr_length );
+    CIPSTER_TRACE_INFO( "%s[%d]: %d bytes received on global broadcast UDP\n",
+        __func__, s_sockets.udp_global_broadcast_listener, received_size );
 
-        if( received_size <= 0 ) // got error
+    int reply_length = Encapsulation::HandleReceivedExplicitUdpData(
+            s_sockets.udp_global_broadcast_listener, from_addr,
+            BufReader( s_sockets.udp_global_broadcast_buf, received_size ),
+            BufWriter( s_sockets.udp_global_broadcast_buf, S_BUFZ ), false );
+
+    if( reply_length > 0 )
+    {
+        // if the active socket matches a registered UDP callback, handle a UDP packet
+        int sent_count = sendto( s_sockets.udp_global_broadcast_listener,
+                    (char*) s_sockets.udp_global_broadcast_buf, reply_length, 0,
+                    from_addr, SADDRZ );
+
+        CIPSTER_TRACE_INFO( "%s[%d]: sent %d reply bytes\n",
+            __func__, s_sockets.udp_global_broadcast_listener, sent_count );
+
+        if( sent_count != reply_length )
         {
-            CIPSTER_TRACE_ERR(
-                    "%s[%d]: error on recvfrom UDP local broadcast socket: '%s'\n",
-                    __func__,
-                    s_sockets.udp_local_broadcast_listener,
-                    strerrno().c_str() );
-            return;
+            CIPSTER_TRACE_INFO(
+                    "%s[%d]: UDP response was not fully sent\n",
+                    __func__, s_sockets.udp_global_broadcast_listener );
         }
+    }
+}
+
+
+/// Return now on the g_current_usecs time line, which is behind now by as
+/// long as it has been since advanceClock().
+static uint64_t stack_usecs_now()
+{
+    return g_current_usecs + unsigned( usecs_now() - s_last_usecs );
+}
 
-        int reply_length = Encapsulation::HandleReceivedExplicitUdpData(
-                s_sockets.udp_local_broadcast_listener, from_addr,
-                BufReader( s_buf, received_size ),
-                BufWriter( s_buf, S_BUFZ ), false );
 
-        if( reply_length > 0 )
+#if defined(CIPSTER_USE_RX_TIMESTAMPS)
+/**
+ * Function rxStamp
+ * returns when the datagram received into @a aHdr arrived, from its kernel
+ * timestamp if it has one.  That is on CLOCK_REALTIME, so only its distance
+ * from @a aRealNow, taken with @a aStackNow, is used.
+ */
+static RxStamp rxStamp( msghdr& aHdr, const timespec& aRealNow, uint64_t aStackNow )
+{
+    RxStamp stamp = { aStackNow, 0 };
+
+    for( cmsghdr* c = CMSG_FIRSTHDR( &aHdr );  c;  c = CMSG_NXTHDR( &aHdr, c ) )
+    {
+        if( c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPNS )
         {
-            // if the active socket matches a registered UDP callback, handle a UDP packet
-            int sent_count = sendto( s_sockets.udp_local_broadcast_listener,
-                        (char*) s_buf, reply_length, 0,
-                        from_addr, sizeof(from_addr) );
+            timespec arrived;
+
+            memcpy( &arrived, CMSG_DATA( c ), sizeof arrived );
 
-            CIPSTER_TRACE_INFO( "%s[%d]: sent %d reply bytes\n",
-                __func__, s_sockets.udp_local_broadcast_listener, sent_count );
+            int64_t queued = int64_t( aRealNow.tv_sec - arrived.tv_sec ) * 1000000
+                                + ( aRealNow.tv_nsec - arrived.tv_nsec ) / 1000;
 
-            if( sent_count != reply_length )
+            // Ignore a stamp the wrong side of a step of the clock.
+            if( queued > 0 && queued < 1000000 )
             {
-                CIPSTER_TRACE_INFO(
-                    "%s[%d]: UDP response was not fully sent\n",
-                    __func__, s_sockets.udp_local_broadcast_listener );
+                stamp.arrived_usecs -= queued;
+                stamp.queued_usecs   = uint32_t( queued );
             }
+            break;
         }
     }
+
+    return stamp;
 }
+#endif
 
 
-void CheckAndHandleUdpGlobalBroadcastSocket()
+/**
+ * Function drainUdpSocket
+ * reads inbound datagrams from @a aSocket, which is known to be readable,
+ * and passes each one up to RecvConnectedData() for filtering.
+ */
+static void drainUdpSocket( UdpSocket* s )
 {
-    SockAddr    from_addr;
-    socklen_t   from_addr_length;
+    s->Show();
+
+    CIPSTER_TRACE_INFO( "GOT ONE %s[%d]\n", __func__, s->h() );
+
+    // Since it is non-blocking, call Recv() until
+    // byte_count is <= 0.  Keep socket open for every case.
+
+    // Drain each UDP socket up to some limit you can choose.
+    // This strategy contemplates that somebody might be bombing us,
+    // maybe even maliciously.  Anything we don't fetch out now
+    // will likely still be there on the next call to
+    // NetworkHandlerProcessOnce() and we should eventually catch up.
+    int limit = 64 * s->RefCount();
+
+    int attempt;
 
-    // see if this is an unsolicited inbound UDP message
-    if( checkSocketSet( s_sockets.udp_global_broadcast_listener ) )
+#if defined(CIPSTER_USE_RECVMMSG)
+    for( attempt = 0;  attempt < limit;  )
     {
-        from_addr_length = sizeof(from_addr);
+        int want = std::min( UDP_RX_BATCH, limit - attempt );
 
-        CIPSTER_TRACE_STATE(
-            "%s[%d]: unsolicited UDP on global broadcast socket\n",
-            __func__, s_sockets.udp_global_broadcast_listener );
+        for( int i = 0; i < want;  ++i )
+        {
+            msghdr& hdr = rx_msgs[i].msg_hdr;
+
+            rx_iovs[i].iov_base = rx_bufs[i];
+            rx_iovs[i].iov_len  = sizeof rx_bufs[i];
+
+            hdr.msg_name        = &rx_addrs[i];
+            hdr.msg_namelen     = sizeof rx_addrs[i];
+            hdr.msg_iov         = &rx_iovs[i];
+            hdr.msg_iovlen      = 1;
+#if defined(CIPSTER_USE_RX_TIMESTAMPS)
+            hdr.msg_control     = rx_ctrls[i].bytes;
+            hdr.msg_controllen  = sizeof rx_ctrls[i].bytes;
+#else
+            hdr.msg_control     = NULL;
+            hdr.msg_controllen  = 0;
+#endif
+            hdr.msg_flags       = 0;
+        }
 
-        // Handle UDP broadcast messages
-        int received_size = recvfrom( s_sockets.udp_global_broadcast_listener,
-                (char*) s_buf, S_BUFZ, 0,
-                from_addr, &from_addr_length );
+        int count = recvmmsg( s->h(), rx_msgs, want, MSG_DONTWAIT, NULL );
 
-        if( received_size <= 0 ) // got error
+        if( count <= 0 )
         {
-            CIPSTER_TRACE_ERR(
-                "%s[%d]: error on recvfrom UDP global broadcast socket: '%s'\n",
-                __func__,
-                s_sockets.udp_global_broadcast_listener,
-                strerrno().c_str() );
+            if( count < 0 && errno != EAGAIN && errno != EWOULDBLOCK )
+            {
+                CIPSTER_TRACE_ERR( "%s[%d]: errno: '%s'\n",
+                    __func__, s->h(), strerrno().c_str() );
+            }
 
-            return;
+            break;
         }
 
-        CIPSTER_TRACE_INFO( "%s[%d]: %d bytes received on global broadcast UDP\n",
-            __func__, s_sockets.udp_global_broadcast_listener, received_size );
+        uint64_t stack_now = stack_usecs_now();
+
+#if defined(CIPSTER_USE_RX_TIMESTAMPS)
+        timespec real_now;
 
-        int reply_length = Encapsulation::HandleReceivedExplicitUdpData(
-                s_sockets.udp_global_broadcast_listener, from_addr,
-                BufReader( s_buf, received_size ),
-                BufWriter( s_buf, S_BUFZ ), false );
+        clock_gettime( CLOCK_REALTIME, &real_now );
+#endif
 
-        if( reply_length > 0 )
+        for( int i = 0; i < count;  ++i )
         {
-            // if the active socket matches a registered UDP callback, handle a UDP packet
-            int sent_count = sendto( s_sockets.udp_global_broadcast_listener,
-                        (char*) s_buf, reply_length, 0,
-                        from_addr, SADDRZ );
+#if defined(CIPSTER_USE_RX_TIMESTAMPS)
+            RxStamp stamp = rxStamp( rx_msgs[i].msg_hdr, real_now, stack_now );
+#else
+            RxStamp stamp = { stack_now, 0 };
+#endif
+            CipConnMgrClass::RecvConnectedData( s, SockAddr( rx_addrs[i] ),
+                BufReader( rx_bufs[i], rx_msgs[i].msg_len ), stamp );
+        }
+
+        attempt += count;
+
+        if( count < want )      // the socket is drained
+            break;
+    }
+#else
+    for( attempt = 0;  attempt < limit;  ++attempt )
+    {
+        SockAddr    from_addr;
 
-            CIPSTER_TRACE_INFO( "%s[%d]: sent %d reply bytes\n",
-                __func__, s_sockets.udp_global_broadcast_listener, sent_count );
+        int byte_count = s->Recv( &from_addr, BufWriter( s_io_buf, S_BUFZ ) );
 
-            if( sent_count != reply_length )
+        if( byte_count <= 0 )
+        {
+#if defined(_WIN32)
+            if (WSAGetLastError () != WSAEWOULDBLOCK)
+#else
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+#endif
             {
-                CIPSTER_TRACE_INFO(
-                        "%s[%d]: UDP response was not fully sent\n",
-                        __func__, s_sockets.udp_global_broadcast_listener );
+                CIPSTER_TRACE_ERR( "%s[%d]: errno: '%s'\n",
+                    __func__, s->h(), strerrno().c_str() );
             }
+
+            break;
         }
+
+        RxStamp stamp = { stack_usecs_now(), 0 };
+
+        CipConnMgrClass::RecvConnectedData(
+            s, from_addr, BufReader( s_io_buf, byte_count ), stamp );
+    }
+#endif
+
+    if( attempt && attempt == limit )
+    {
+        CIPSTER_TRACE_ERR( "%s[%d]: too much inbound UDP traffic\n",
+            __func__, s->h() );
     }
 }
 
 
+#if !defined(CIPSTER_USE_EPOLL)
 /**
  * Function checkAndHandleUdpSockets
  * checks all open UDP sockets for inbound data, and passes any packets
@@ -458,117 +890,1095 @@ static void checkAndHandleUdpSockets()
 
     UdpSocketMgr::sockets& all = UdpSocketMgr::GetAllSockets(); // UDP only
 
-    SockAddr    from_addr;
-
     for( UdpSocketMgr::sock_iter it = all.begin();  it != all.end();  ++it )
     {
-        UdpSocket*  s = *it;
+        if( checkSocketSet( (*it)->h() ) )
+            drainUdpSocket( *it );
+    }
+}
+#endif
 
-        s->Show();
 
-        if( checkSocketSet( s->h() ) )
-        {
-            CIPSTER_TRACE_INFO( "GOT ONE %s[%d]\n", __func__, s->h() );
+/**
+ * Function watchSession
+ * tells the event loop what @a aSession is waiting for: the rest of its
+ * requests while its transmit queue is below CIPSTER_TCP_TX_HIGH_WATER, no
+ * message router worker has its request and no request waits for the queue
+ * to drain, and writability while that queue holds anything.  Readability
+ * is level triggered, so it must not be watched while it would be ignored.
+ */
+static void watchSession( EncapSession* aSession )
+{
+    bool reading = aSession->m_tx_queue.Size() < CIPSTER_TCP_TX_HIGH_WATER &&
+                   !aSession->m_mr_pending && !aSession->m_rx_held;
+    bool writing = !aSession->m_tx_queue.Empty();
 
-            // Since it is non-blocking, call Recv() until
-            // byte_count is <= 0.  Keep socket open for every case.
+    if( reading == aSession->m_reading && writing == aSession->m_writing )
+        return;
 
-            // Drain each UDP socket up to some limit you can choose.
-            // This strategy contemplates that somebody might be bombing us,
-            // maybe even maliciously.  Anything we don't fetch out now
-            // will likely still be there on the next call to
-            // NetworkHandlerProcessOnce() and we should eventually catch up.
-            int limit = 64 * s->RefCount();
+    aSession->m_reading = reading;
+    aSession->m_writing = writing;
 
-            int attempt;
-            for( attempt = 0;  attempt < limit;  ++attempt )
-            {
-                int byte_count = s->Recv( &from_addr, BufWriter( s_buf, S_BUFZ ) );
+    int socket = aSession->m_socket;
 
-                if( byte_count <= 0 )
-                {
-#if defined(_WIN32)
-                    if (WSAGetLastError () != WSAEWOULDBLOCK)
-#else
-                    if (errno != EAGAIN && errno != EWOULDBLOCK)
-#endif
-                    {
-                        CIPSTER_TRACE_ERR( "%s[%d]: errno: '%s'\n",
-                            __func__, s->h(), strerrno().c_str() );
-                    }
+    CIPSTER_TRACE_INFO( "%s[%d]: reading:%d writing:%d\n",
+        __func__, socket, reading, writing );
 
-                    break;
-                }
+#if defined(CIPSTER_USE_EPOLL)
+    epoll_event ev;
 
-                CipConnMgrClass::RecvConnectedData(
-                    s, from_addr, BufReader( s_buf, byte_count ) );
-            }
+    ev.events   = ( reading ? EPOLLIN : 0 ) | ( writing ? EPOLLOUT : 0 );
+    ev.data.u64 = event_cookie( aSession, kEventSession );
+
+    if( epoll_ctl( epoll_fd, EPOLL_CTL_MOD, socket, &ev ) )
+    {
+        CIPSTER_TRACE_ERR( "%s[%d]: epoll_ctl() errno:'%s'\n",
+            __func__, socket, strerrno().c_str() );
+    }
+#else
+    if( reading )
+        FD_SET( socket, &master_set );
+    else
+        FD_CLR( socket, &master_set );
+
+    if( writing )
+        FD_SET( socket, &write_master_set );
+    else
+        FD_CLR( socket, &write_master_set );
+#endif
+}
+
+
+/**
+ * Function sendTcp
+ * sends as much of @a aBytes on @a aSocket as it will take without blocking.
+ *
+ * @return int - the count sent, possibly 0, or -1 if the connection failed.
+ */
+static int sendTcp( int aSocket, const uint8_t* aBytes, int aCount )
+{
+#if defined(MSG_NOSIGNAL)
+    // a peer which went away is reported here, not with SIGPIPE.
+    int sent_count = send( aSocket, (const char*) aBytes, aCount, MSG_NOSIGNAL );
+#else
+    int sent_count = send( aSocket, (const char*) aBytes, aCount, 0 );
+#endif
+
+    if( sent_count < 0 )
+    {
+#if defined(_WIN32)
+        if( WSAGetLastError() == WSAEWOULDBLOCK )
+#else
+        if( errno == EAGAIN || errno == EWOULDBLOCK )
+#endif
+            return 0;
+
+        CIPSTER_TRACE_ERR( "%s[%d]: send() error: %s\n",
+                __func__, aSocket, strerrno().c_str() );
+    }
+
+    return sent_count;
+}
+
+
+/**
+ * Function flushTcpQueue
+ * sends what the socket will take of @a aSession's transmit queue, in one
+ * send() however many replies it holds, and resumes reading once the queue
+ * is below the high water mark.
+ */
+static EipStatus flushTcpQueue( EncapSession* aSession )
+{
+    TxQueue& q = aSession->m_tx_queue;
+
+    if( !q.Empty() )
+    {
+        int sent_count = sendTcp( aSession->m_socket, q.Head(), q.Size() );
+
+        CIPSTER_TRACE_INFO( "%s[%d]: sent %d of %d queued bytes\n",
+                __func__, aSession->m_socket, sent_count, q.Size() );
+
+        if( sent_count < 0 )
+            return kEipStatusError;
+
+        q.Take( sent_count );
+    }
+
+    watchSession( aSession );
+
+    return kEipStatusOk;
+}
+
+
+/**
+ * Function handleTcpMsgs
+ * handles each whole message received into @a aSession's buffer, appending
+ * the replies to its transmit queue, then sends them together.  Messages
+ * beyond the high water mark wait in the buffer until the queue drains, as
+ * do those behind one given to a message router worker.
+ */
+static EipStatus handleTcpMsgs( EncapSession* aSession )
+{
+    int         socket = aSession->m_socket;
+    uint8_t*    buf = aSession->m_buf;
+
+    TxQueue& q = aSession->m_tx_queue;
+
+    bool held_back;
+
+    do
+    {
+        int start = 0;
+
+        held_back = false;
+        aSession->m_rx_held = false;
+
+        for(;;)
+        {
+            int length = Encapsulation::TcpMsgLength(
+                            buf + start, aSession->m_rx_count - start );
+
+            if( length < 0 )
+                return kEipStatusError;
+
+            if( length == 0 )
+                break;
+
+            if( q.Size() >= CIPSTER_TCP_TX_HIGH_WATER )
+            {
+                held_back = true;
+                break;
+            }
+
+            // An UnregisterSession closes the session, so it waits in the
+            // buffer until the replies to the messages ahead of it are sent.
+            if( ( buf[start] | (buf[start+1] << 8) ) == kEncapCmdUnregisterSession )
+            {
+                if( kEipStatusError == flushTcpQueue( aSession ) )
+                    return kEipStatusError;
+
+                if( !q.Empty() )
+                {
+                    aSession->m_rx_held = true;
+                    break;
+                }
+            }
+
+            uint8_t* reply = q.Room( MsgBufPool::kBufSize );
+
+            int replyz = Encapsulation::HandleReceivedExplicitTcpData( socket,
+                            BufReader( buf + start, length ),
+                            BufWriter( reply, MsgBufPool::kBufSize ) );
+
+            // It did, buf and all.
+            if( aSession->m_socket != socket )
+                return kEipStatusOk;
+
+            // This message is handled again once the worker has finished,
+            // until then the ones behind it wait in the buffer.
+            if( replyz == kEncapReplyPending )
+            {
+                aSession->m_mr_pending = true;
+                break;
+            }
+
+            if( replyz < 0 )
+            {
+                CIPSTER_TRACE_INFO(
+                    "%s[%d]: < 0 length reply from HandleReceivedExplicitTcpData()\n",
+                    __func__, socket );
+
+                return kEipStatusError;
+            }
+
+#if defined(DEBUG) && 0
+            byte_dump( "sTCP", reply, replyz );
+#endif
+            q.Append( replyz );
+
+            start += length;
+        }
+
+        // Move a partial message, or ones held back, to the front.
+        aSession->m_rx_count -= start;
+        memmove( buf, buf + start, aSession->m_rx_count );
+
+        if( kEipStatusError == flushTcpQueue( aSession ) )
+            return kEipStatusError;
+
+        // If the send made room, nothing else will wake us for the rest.
+    } while( held_back && aSession->m_reading );
+
+    return kEipStatusOk;
+}
+
+
+/**
+ * Function HandleDataOnTcpSocket
+ * receives what has arrived on @a aSession's TCP connection, which may be
+ * any number of pipelined messages, and replies to each whole one.
+ */
+static EipStatus HandleDataOnTcpSocket( EncapSession* aSession )
+{
+    int num_read = Encapsulation::ReceiveTcpData( aSession );
+
+    if( num_read < 0 )
+        return kEipStatusError;
+
+    if( num_read == 0 )
+        return kEipStatusOk;    // nothing new, wait for more
+
+    return handleTcpMsgs( aSession );
+}
+
+
+/**
+ * Function HandleWritableTcpSocket
+ * sends more of @a aSession's transmit queue, and once that lets reading
+ * resume, handles the messages which were held back by the high water mark.
+ * Once it is empty, so also one which waited for that.
+ */
+static EipStatus HandleWritableTcpSocket( EncapSession* aSession )
+{
+    if( kEipStatusError == flushTcpQueue( aSession ) )
+        return kEipStatusError;
+
+    if( aSession->m_rx_count && ( aSession->m_reading ||
+            ( aSession->m_rx_held && aSession->m_tx_queue.Empty() ) ) )
+        return handleTcpMsgs( aSession );
+
+    return kEipStatusOk;
+}
+
+
+#if defined(CIPSTER_USE_EPOLL)
+/**
+ * Function clearCount
+ * reads the count of a timerfd or eventfd which was ready, so that it is not
+ * ready again until it next expires or is written.
+ */
+static void clearCount( int aFd )
+{
+    uint64_t count;
+
+    // only needs clearing, the deadline or call is serviced by our caller.
+    if( read( aFd, &count, sizeof count ) < 0 && errno != EAGAIN )
+    {
+        CIPSTER_TRACE_ERR( "%s[%d]: read errno:'%s'\n",
+            __func__, aFd, strerrno().c_str() );
+    }
+}
+#endif
+
+
+#if CIPSTER_MR_WORKERS
+/**
+ * Function resumeSessions
+ * handles again the messages of each session whose request a message router
+ * worker has finished, which now picks up the worker's reply.
+ */
+static void resumeSessions()
+{
+    clearCount( mr_done_fd );
+
+    while( CipUdint session_handle = CipMessageRouterClass::TakeFinished() )
+    {
+        EncapSession* session = SessionMgr::GetSession( session_handle );
+
+        if( !session )
+            continue;
+
+        int socket = session->m_socket;
+
+        session->m_mr_pending = false;
+
+        if( kEipStatusError == handleTcpMsgs( session ) )
+        {
+            CIPSTER_TRACE_INFO( "%s[%d]: calling CloseBySocket()\n",
+                __func__, socket );
+            SessionMgr::CloseBySocket( socket );
+        }
+    }
+}
+#endif
+
+
+#if defined(CIPSTER_WITH_IO_THREAD)
+/**
+ * Function ring
+ * adds one to eventfd @a aFd, making it ready for the thread which waits on it.
+ */
+static void ring( int aFd )
+{
+    uint64_t one = 1;
+
+    if( write( aFd, &one, sizeof one ) < 0 )
+    {
+        CIPSTER_TRACE_ERR( "%s[%d]: write errno:'%s'\n",
+            __func__, aFd, strerrno().c_str() );
+    }
+}
+
+
+/**
+ * Function runIoCalls
+ * runs on the I/O thread the calls queued by IoThreadCall(), telling the
+ * waiting caller as each one finishes.
+ */
+static void runIoCalls()
+{
+    ThreadCall call;
+
+    clearCount( io_wake_fd );
+
+    while( io_calls.Pop( &call ) )
+    {
+        try
+        {
+            call.func( call.arg );
+        }
+        catch( ... )
+        {
+            io_call_error = std::current_exception();
+        }
+
+        io_calls_done.fetch_add( 1, std::memory_order_release );
+        ring( io_done_fd );
+    }
+}
+
+
+/**
+ * Function runExplicitCalls
+ * runs on the explicit thread the calls queued by ExplicitThreadPost().
+ */
+static void runExplicitCalls()
+{
+    ThreadCall call;
+
+    clearCount( explicit_wake_fd );
+
+    while( explicit_calls.Pop( &call ) )
+        call.func( call.arg );
+}
+
+
+static bool onIoThread()
+{
+    return io_thread_running && pthread_equal( pthread_self(), io_thread );
+}
+#endif
+
+
+void NetworkHandlerWake()
+{
+#if defined(CIPSTER_USE_EPOLL)
+    if( trigger_fd != -1 )
+    {
+        int         saved = errno;  // maybe in a signal handler
+        uint64_t    one = 1;
+
+        // Only fails if the count would overflow, then it is ready anyway.
+        ssize_t     r = write( trigger_fd, &one, sizeof one );
+
+        (void) r;
+        errno = saved;
+    }
+#endif
+}
+
+
+void IoThreadCall( void (*aFunc)( void* ), void* aArg )
+{
+#if defined(CIPSTER_WITH_IO_THREAD)
+    if( io_thread_running && !onIoThread() )
+    {
+        ThreadCall call = { aFunc, aArg };
+
+        unsigned done = io_calls_done.load( std::memory_order_relaxed );
+
+        // The queue is never full since each call is waited for.
+        io_calls.Push( call );
+        ring( io_wake_fd );
+
+        uint64_t count;
+
+        while( read( io_done_fd, &count, sizeof count ) < 0 && errno == EINTR )
+            ;
+
+        // pairs with the release in runIoCalls(), making the call's results
+        // visible here.
+        while( io_calls_done.load( std::memory_order_acquire ) == done )
+            ;
+
+        if( io_call_error )
+        {
+            std::exception_ptr error = io_call_error;
+
+            io_call_error = std::exception_ptr();
+            std::rethrow_exception( error );
+        }
+
+        return;
+    }
+#endif
+
+    aFunc( aArg );
+}
+
+
+void ExplicitThreadPost( void (*aFunc)( void* ), void* aArg )
+{
+#if defined(CIPSTER_WITH_IO_THREAD)
+    if( onIoThread() )
+    {
+        ThreadCall call = { aFunc, aArg };
+
+        if( explicit_calls.Push( call ) )
+            ring( explicit_wake_fd );
+        else
+        {
+            CIPSTER_TRACE_ERR( "%s: explicit thread call queue is full\n",
+                __func__ );
+        }
+
+        return;
+    }
+#endif
+
+    aFunc( aArg );
+}
+
+
+#if defined(__linux__)
+
+/// Bytes of stack and of heap NetworkHandlerRealTime() prefaults.
+static const unsigned kRtPrefaultStack = 256 * 1024;
+static const unsigned kRtPrefaultHeap  = 4 * 1024 * 1024;
+
+// Only the thread driving the I/O connections touches these.
+static bool             rt_counting;
+static RealTimeStats    rt_stats;
+static rusage           rt_pass_start;
+
+struct RtSetup
+{
+    int         priority;
+    int         cpu;
+    bool        lock_memory;
+    EipStatus   result;
+};
+
+
+/**
+ * Function prefault
+ * writes a byte in every page of the @a aSize bytes at @a aBytes, so each is
+ * faulted in now rather than on the hot path.
+ */
+static void prefault( volatile uint8_t* aBytes, unsigned aSize )
+{
+    long page = sysconf( _SC_PAGESIZE );
+
+    for( unsigned i = 0;  i < aSize;  i += page )
+        aBytes[i] = 0;
+}
+
+
+/// Fault in kRtPrefaultStack bytes of this thread's stack, below the caller.
+static void __attribute__((noinline)) prefault_stack()
+{
+    uint8_t stack[kRtPrefaultStack];
+
+    prefault( stack, sizeof stack );
+}
+
+
+/// Is given to IoThreadCall() to run on the thread driving I/O.
+static void rt_setup( void* aArg )
+{
+    RtSetup* setup = (RtSetup*) aArg;
+    int      error;
+
+    setup->result = kEipStatusOk;
+
+    if( setup->cpu >= 0 )
+    {
+        cpu_set_t cpus;
+
+        CPU_ZERO( &cpus );
+        CPU_SET( setup->cpu, &cpus );
+
+        error = pthread_setaffinity_np( pthread_self(), sizeof cpus, &cpus );
+
+        if( error )
+        {
+            CIPSTER_TRACE_ERR( "%s: pthread_setaffinity_np( cpu %d ) error:'%s'\n",
+                __func__, setup->cpu, strerror( error ) );
+            setup->result = kEipStatusError;
+        }
+    }
+
+    if( setup->lock_memory )
+    {
+        // Keep freed heap, and make large blocks from it too rather than from
+        // mmap(), so what is prefaulted and locked here stays so.
+        mallopt( M_TRIM_THRESHOLD, -1 );
+        mallopt( M_MMAP_MAX, 0 );
+
+        if( mlockall( MCL_CURRENT | MCL_FUTURE ) )
+        {
+            CIPSTER_TRACE_ERR( "%s: mlockall() errno:'%s'\n",
+                __func__, strerrno().c_str() );
+            setup->result = kEipStatusError;
+        }
+
+        uint8_t* heap = (uint8_t*) malloc( kRtPrefaultHeap );
+
+        if( heap )
+        {
+            prefault( heap, kRtPrefaultHeap );
+            free( heap );
+        }
+
+        prefault_stack();
+    }
+
+    // Last, so the above runs at the old priority.
+    if( setup->priority > 0 )
+    {
+        sched_param param;
+
+        memset( &param, 0, sizeof param );
+        param.sched_priority = setup->priority;
+
+        error = pthread_setschedparam( pthread_self(), SCHED_FIFO, &param );
+
+        if( error )
+        {
+            CIPSTER_TRACE_ERR( "%s: SCHED_FIFO priority %d error:'%s'\n",
+                __func__, setup->priority, strerror( error ) );
+            setup->result = kEipStatusError;
+        }
+    }
+
+    memset( &rt_stats, 0, sizeof rt_stats );
+    rt_counting = true;
+
+    // This may be mid pass, so count the rest of it from here.
+    getrusage( RUSAGE_THREAD, &rt_pass_start );
+}
+
+
+static void rt_stats_copy( void* aArg )
+{
+    RealTimeStats** stats = (RealTimeStats**) aArg;
+
+    *stats[0] = rt_stats;
+
+    if( stats[1] )
+        memset( &rt_stats, 0, sizeof rt_stats );
+}
+
+
+/// Call on the thread driving I/O as it starts servicing what it waited for.
+static inline void rtPassBegin()
+{
+    if( rt_counting )
+        getrusage( RUSAGE_THREAD, &rt_pass_start );
+}
+
+
+/// Call on the thread driving I/O once it is done servicing.
+static inline void rtPassEnd()
+{
+    if( rt_counting )
+    {
+        rusage end;
+
+        getrusage( RUSAGE_THREAD, &end );
+
+        ++rt_stats.passes;
+        rt_stats.minor_faults += end.ru_minflt - rt_pass_start.ru_minflt;
+        rt_stats.major_faults += end.ru_majflt - rt_pass_start.ru_majflt;
+        rt_stats.voluntary_switches   += end.ru_nvcsw - rt_pass_start.ru_nvcsw;
+        rt_stats.involuntary_switches += end.ru_nivcsw - rt_pass_start.ru_nivcsw;
+    }
+}
+
+#else
+
+static inline void rtPassBegin()    {}
+static inline void rtPassEnd()      {}
+
+#endif
+
+
+EipStatus NetworkHandlerRealTime( int aPriority, int aCpu, bool aLockMemory )
+{
+#if defined(__linux__)
+    RtSetup setup = { aPriority, aCpu, aLockMemory, kEipStatusOk };
+
+    IoThreadCall( rt_setup, &setup );
+
+    return setup.result;
+#else
+    (void) aPriority;
+    (void) aCpu;
+    (void) aLockMemory;
+
+    CIPSTER_TRACE_ERR( "%s: only supported on Linux\n", __func__ );
+    return kEipStatusError;
+#endif
+}
+
+
+void NetworkHandlerRealTimeStats( RealTimeStats* aStats, bool aReset )
+{
+#if defined(__linux__)
+    RealTimeStats* stats[2] = { aStats, aReset ? aStats : NULL };
+
+    IoThreadCall( rt_stats_copy, stats );
+#else
+    (void) aReset;
+
+    memset( aStats, 0, sizeof *aStats );
+#endif
+}
+
+
+#if defined(CIPSTER_USE_EPOLL)
+/**
+ * Function dispatchEvents
+ * hands each ready socket in @a aEvents to its handler, as found from the
+ * tagged cookie given to master_set_add().  Only ready sockets are visited.
+ */
+static void dispatchEvents( const epoll_event* aEvents, int aCount )
+{
+    bool accept_pending = false;
+
+    for( int i = 0;  i < aCount;  ++i )
+    {
+        uint64_t    cookie = aEvents[i].data.u64;
+        void*       owner  = (void*) uintptr_t( cookie & ~uint64_t( kEventTagMask ) );
+
+        switch( cookie & kEventTagMask )
+        {
+        case kEventListener:
+            {
+                int listener = int( cookie >> 2 );
+
+                if( listener == s_sockets.tcp_listener )
+                    accept_pending = true;
+                else if( listener == s_sockets.udp_unicast_listener )
+                    handleUdpUnicastSocket();
+                else if( listener == s_sockets.udp_local_broadcast_listener )
+                    handleUdpLocalBroadcastSocket();
+                else if( listener == s_sockets.udp_global_broadcast_listener )
+                    handleUdpGlobalBroadcastSocket();
+                else if( listener == timer_fd )
+                    clearCount( timer_fd );
+                else if( listener == trigger_fd )
+                {
+                    // advanceClock() produces those now due
+                    clearCount( trigger_fd );
+                    CipConnMgrClass::TriggerChangedAssemblies();
+                }
+#if CIPSTER_MR_WORKERS
+                else if( listener == mr_done_fd )
+                    resumeSessions();
+#endif
+#if defined(CIPSTER_WITH_IO_THREAD)
+                else if( listener == io_timer_fd )
+                    clearCount( io_timer_fd );
+                else if( listener == io_wake_fd )
+                    runIoCalls();
+                else if( listener == explicit_wake_fd )
+                    runExplicitCalls();
+#endif
+            }
+            break;
+
+        case kEventUdp:
+            drainUdpSocket( (UdpSocket*) owner );
+            break;
+
+        case kEventSession:
+            {
+                // The session may have been closed by an earlier event in
+                // this batch, then its m_socket is kSocketInvalid.
+                EncapSession* session = (EncapSession*) owner;
+                int socket = session->m_socket;
+                uint32_t events = aEvents[i].events;
+
+                if( socket == kSocketInvalid )
+                    break;
+
+                EipStatus result = kEipStatusOk;
+                bool handled = false;
+
+                // A failed or hung up peer with a queue is found by sending.
+                if( !session->m_tx_queue.Empty() &&
+                    ( events & ( EPOLLOUT | EPOLLERR | EPOLLHUP ) ) )
+                {
+                    result = HandleWritableTcpSocket( session );
+                    handled = true;
+                }
+
+                if( result != kEipStatusError && session->m_reading &&
+                    ( events & ( EPOLLIN | EPOLLERR | EPOLLHUP ) ) )
+                {
+                    result = HandleDataOnTcpSocket( session );
+                    handled = true;
+                }
+
+                // Neither watched, e.g. a worker has its request, yet these
+                // are always reported and would be again and again.
+                if( !handled && ( events & ( EPOLLERR | EPOLLHUP ) ) )
+                    result = kEipStatusError;
+
+                if( result == kEipStatusError )
+                {
+                    CIPSTER_TRACE_INFO( "%s[%d]: calling CloseBySocket()\n",
+                        __func__, socket );
+                    SessionMgr::CloseBySocket( socket );
+                }
+            }
+            break;
+        }
+    }
+
+    // Accept last, so a session slot freed above cannot be handed to a new
+    // TCP connection while a stale event for it is still in aEvents.
+    if( accept_pending )
+        handleTcpListenerSocket();
+}
+#endif
+
+
+/**
+ * Function waitUSecs
+ * returns how long NetworkHandlerProcessOnce() may block before the next
+ * stack deadline must be serviced, but no more than @a aMaxWaitUSecs.
+ */
+static unsigned waitUSecs( unsigned aMaxWaitUSecs )
+{
+    if( !aMaxWaitUSecs )
+        return 0;
+
+    // All the deadlines below are relative to s_last_usecs, which is when
+    // g_current_usecs was last advanced.  lag is the time since then.
+    int64_t lag  = unsigned( usecs_now() - s_last_usecs );
+    int64_t wake = int64_t( aMaxWaitUSecs ) + lag;
+
+    const int32_t never = 0x7fffffff;
+
+    // advanceClock() services a connection on its own deadline, between ticks.
+    int32_t conn_due = CipConnMgrClass::NextTimerUSecs( never );
+
+    if( conn_due < wake )
+        wake = std::max( conn_due, 0 );
+
+#if defined(CIPSTER_WITH_IO_THREAD)
+    // The explicit thread sends the ListIdentity replies, see explicitWaitUSecs().
+    int32_t due = never;
+#else
+    int32_t due = NextEncapsulationMessageUSecs( never );
+#endif
+
+    if( due != never )
+    {
+        const int64_t tick = kCIPsterTimerTickInMicroSeconds;
+
+        // ManageEncapsulationMessages() only runs on a tick boundary, so wake
+        // on the first one at or after the deadline, and never before the next.
+        int64_t ticks = ( due + s_sockets.elapsed_time_usecs + tick - 1 ) / tick;
+
+        if( ticks < 1 )
+            ticks = 1;
+
+        int64_t tick_wake = ticks * tick - s_sockets.elapsed_time_usecs;
+
+        if( tick_wake < wake )
+            wake = tick_wake;
+    }
+
+#if !defined(CIPSTER_WITH_IO_THREAD)
+    int64_t inactivity_wake = int64_t( INACTIVITY_CHECK_PERIOD_USECS )
+                                - s_sockets.tcp_inactivity_usecs;
+
+    if( inactivity_wake < wake )
+        wake = inactivity_wake;
+#endif
+
+    wake -= lag;
+
+    return wake > 0 ? unsigned( wake ) : 0;
+}
+
+
+#if defined(CIPSTER_WITH_IO_THREAD)
+/**
+ * Function explicitWaitUSecs
+ * returns how long the explicit thread may block in NetworkHandlerProcessOnce()
+ * before a delayed ListIdentity reply or the TCP inactivity check is due, but
+ * no more than @a aMaxWaitUSecs.
+ */
+static unsigned explicitWaitUSecs( unsigned aMaxWaitUSecs )
+{
+    if( !aMaxWaitUSecs )
+        return 0;
+
+    int64_t lag  = unsigned( usecs_now() - explicit_last_usecs );
+    int64_t wake = aMaxWaitUSecs;
+
+    const int32_t never = 0x7fffffff;
+
+    int32_t due = NextEncapsulationMessageUSecs( never );
+
+    if( due != never )
+    {
+        // This is relative to CurrentUSecs32(), which only moves when the I/O
+        // thread ticks, so waking sooner than that would find it still not due.
+        int64_t tick_wake = std::max( int64_t( due ),
+                                int64_t( kCIPsterTimerTickInMicroSeconds ) );
+
+        if( tick_wake < wake )
+            wake = tick_wake;
+    }
+
+    int64_t inactivity_wake = int64_t( INACTIVITY_CHECK_PERIOD_USECS )
+                                - s_sockets.tcp_inactivity_usecs - lag;
+
+    if( inactivity_wake < wake )
+        wake = inactivity_wake;
+
+    return wake > 0 ? unsigned( wake ) : 0;
+}
+#endif
+
+
+/**
+ * Function advanceClock
+ * moves g_current_usecs up to now, then calls ManageConnections() once for
+ * each whole kCIPsterTimerTickInMicroSeconds elapsed, carrying the remainder.
+ *
+ * @return unsigned - the usecs elapsed since the previous call.
+ */
+static unsigned advanceClock()
+{
+    unsigned now = usecs_now();
+    unsigned elapsed_usecs = now - s_last_usecs;
+
+    s_last_usecs = now;
+
+    s_sockets.elapsed_time_usecs += elapsed_usecs;
+
+    g_current_usecs += elapsed_usecs;   // accumulate into 64 bits.
+
+    /*  Call ManageConnections() if the elapsed_time_usecs is greater than
+        kCIPsterTimerTickInMicroSeconds.  If more than once cycle
+        was missed, call it more than once so internal time management
+        functions can expect each call to represent kCIPsterTimerTickInMicroSeconds.
+        This will compensate for jitter in how frequently NetworkHandlerProcessOnce()
+        is called.  But please try and call it at least slightly more frequently
+        than every kCIPsterTimerTickInMicroSeconds.
+    */
+    while( s_sockets.elapsed_time_usecs >= kCIPsterTimerTickInMicroSeconds )
+    {
+        ManageConnections();
+
+        // Since we qualified this in the while() test, this will never go
+        // below zero.
+        s_sockets.elapsed_time_usecs -= kCIPsterTimerTickInMicroSeconds;
+    }
+
+    // A triggered connection may be due between ticks, the wait ended for it.
+    if( CipConnMgrClass::NextTimerUSecs( 1 ) <= 0 )
+        CipConnMgrClass::ServiceTimers();
+
+    return elapsed_usecs;
+}
+
+
+#if defined(CIPSTER_USE_EPOLL)
+/**
+ * Function waitEvents
+ * blocks on epoll set @a aEpoll for up to @a aWaitUSecs, using timerfd
+ * @a aTimer in that set to end the wait on time.
+ *
+ * @return int - the count of @a aEvents filled in, or -1 with errno set.
+ */
+static int waitEvents( int aEpoll, int aTimer, unsigned aWaitUSecs,
+        epoll_event* aEvents )
+{
+    int timeout_msecs = 0;
+
+    if( aWaitUSecs )
+    {
+        // epoll_wait() only has millisecond resolution, so block indefinitely
+        // and let aTimer end the wait on the exact deadline.
+        itimerspec  its;
+
+        memset( &its, 0, sizeof its );
+
+        its.it_value.tv_sec  = aWaitUSecs / 1000000;
+        its.it_value.tv_nsec = ( aWaitUSecs % 1000000 ) * 1000;
+
+        if( !timerfd_settime( aTimer, 0, &its, NULL ) )
+            timeout_msecs = -1;
+    }
+
+    return epoll_wait( aEpoll, aEvents, MAX_EPOLL_EVENTS, timeout_msecs );
+}
+#endif
+
+
+#if defined(CIPSTER_WITH_IO_THREAD)
+/**
+ * Function ioThreadMain
+ * is the I/O thread, which reads the UDP sockets of the I/O connections and
+ * runs ManageConnections() on every tick, for the life of the stack.
+ */
+static void* ioThreadMain( void* )
+{
+    epoll_event events[MAX_EPOLL_EVENTS];
+
+    while( !io_thread_stop.load( std::memory_order_acquire ) )
+    {
+        // HandleApplication() is called on every tick, so wake at least that often.
+        int ready_count = waitEvents( io_epoll_fd, io_timer_fd,
+                            waitUSecs( kCIPsterTimerTickInMicroSeconds ), events );
+
+        if( ready_count == -1 )
+        {
+            if( errno == EINTR )
+                continue;
+
+            CIPSTER_TRACE_ERR( "%s: error with epoll_wait: '%s'\n",
+                    __func__, strerrno().c_str() );
+            break;
+        }
+
+        rtPassBegin();
+
+        if( ready_count > 0 )
+            dispatchEvents( events, ready_count );
+
+        advanceClock();
+
+        rtPassEnd();
+    }
+
+    return NULL;
+}
+
+
+/**
+ * Function startIoThread
+ * makes the I/O thread's epoll set, timer and eventfds, and starts it.
+ */
+static EipStatus startIoThread()
+{
+    io_epoll_fd = epoll_create( MAX_EPOLL_EVENTS );
+    io_timer_fd = timerfd_create( CLOCK_MONOTONIC, 0 );
+    io_wake_fd  = eventfd( 0, EFD_NONBLOCK );
+    io_done_fd  = eventfd( 0, 0 );      // IoThreadCall() blocks on this
+    explicit_wake_fd = eventfd( 0, EFD_NONBLOCK );
+
+    if( io_epoll_fd == -1 || io_timer_fd == -1 || io_wake_fd == -1 ||
+        io_done_fd == -1 || explicit_wake_fd == -1 )
+    {
+        CIPSTER_TRACE_ERR( "%s: errno:'%s'\n", __func__, strerrno().c_str() );
+        return kEipStatusError;
+    }
+
+    epoll_event ev;
+
+    ev.events = EPOLLIN;
+
+    ev.data.u64 = event_cookie( io_timer_fd );
+    epoll_ctl( io_epoll_fd, EPOLL_CTL_ADD, io_timer_fd, &ev );
+
+    ev.data.u64 = event_cookie( io_wake_fd );
+    epoll_ctl( io_epoll_fd, EPOLL_CTL_ADD, io_wake_fd, &ev );
+
+    // The I/O thread runs ManageConnections(), so it takes the triggers.
+    ev.data.u64 = event_cookie( trigger_fd );
+    epoll_ctl( io_epoll_fd, EPOLL_CTL_ADD, trigger_fd, &ev );
+
+    master_set_add( "wake", explicit_wake_fd, event_cookie( explicit_wake_fd ) );
+
+    explicit_last_usecs = s_last_usecs;
+    io_thread_stop = false;
+
+    int error = pthread_create( &io_thread, NULL, ioThreadMain, NULL );
 
-            if( attempt && attempt == limit )
-            {
-                CIPSTER_TRACE_ERR( "%s[%d]: too much inbound UDP traffic\n",
-                    __func__, s->h() );
-            }
-        }
+    if( error )
+    {
+        CIPSTER_TRACE_ERR( "%s: pthread_create() error:'%s'\n",
+            __func__, strerror( error ) );
+        return kEipStatusError;
     }
+
+    io_thread_running = true;
+
+    return kEipStatusOk;
 }
 
 
 /**
- * Function HandleDataOnTcpSocket
+ * Function stopIoThread
+ * waits for the I/O thread to finish, then closes what startIoThread() made.
  */
-EipStatus HandleDataOnTcpSocket( int aSocket )
+static void stopIoThread()
 {
-    int num_read = Encapsulation::ReceiveTcpMsg( aSocket,
-                        BufWriter( s_buf, sizeof s_buf ) );
+    if( io_thread_running )
+    {
+        io_thread_stop.store( true, std::memory_order_release );
+        ring( io_wake_fd );
 
-    //CIPSTER_TRACE_INFO( "%s[%d]: num_read:%d\n", __func__, aSocket, num_read );
+        pthread_join( io_thread, NULL );
 
-    if( num_read < ENCAPSULATION_HEADER_LENGTH )
-    {
-        return kEipStatusError;
+        io_thread_running = false;
     }
 
-    int replyz = Encapsulation::HandleReceivedExplicitTcpData( aSocket,
-                        BufReader( s_buf, num_read ),
-                        BufWriter( s_buf, sizeof s_buf ) );
+    int* fds[] = { &io_epoll_fd, &io_timer_fd, &io_wake_fd, &io_done_fd,
+                   &explicit_wake_fd };
 
-    if( replyz > 0 )
+    for( unsigned i = 0; i < DIM( fds );  ++i )
     {
-#if defined(DEBUG) && 0
-        byte_dump( "sTCP", s_buf, replyz );
-#endif
-        int sent_count = send( aSocket, (char*) s_buf, replyz, 0 );
-
-        CIPSTER_TRACE_INFO( "%s[%d]: replied with %d bytes\n",
-                __func__, aSocket, sent_count );
-
-        if( sent_count != replyz )
+        if( *fds[i] != -1 )
         {
-            CIPSTER_TRACE_WARN( "%s[%d]: TCP response was not fully sent\n",
-                    __func__, aSocket );
-        }
+            if( fds[i] == &explicit_wake_fd )
+                master_set_rem( explicit_wake_fd );
 
-        return kEipStatusOk;
+            close( *fds[i] );
+            *fds[i] = -1;
+        }
     }
+}
+#endif
 
-    else if( replyz == 0 )
-    {
-        CIPSTER_TRACE_INFO(
-            "%s[%d]: 0 length reply from HandleReceivedExplicitTcpData()\n",
-            __func__, aSocket );
 
-        return kEipStatusOk;
-    }
+/**
+ * Function freeUdpBufs
+ * gives back to MsgBufPool the buffers NetworkHandlerInitialize() took for
+ * the UDP sockets, those it got.
+ */
+static void freeUdpBufs()
+{
+    MsgBufPool::Free( s_sockets.udp_unicast_buf );
+    MsgBufPool::Free( s_sockets.udp_local_broadcast_buf );
+    MsgBufPool::Free( s_sockets.udp_global_broadcast_buf );
 
-    else
-    {
-        CIPSTER_TRACE_INFO(
-            "%s[%d]: < 0 length reply from HandleReceivedExplicitTcpData()\n",
-            __func__, aSocket );
+    s_sockets.udp_unicast_buf = NULL;
+    s_sockets.udp_local_broadcast_buf = NULL;
+    s_sockets.udp_global_broadcast_buf = NULL;
 
-        return kEipStatusError;
-    }
+#if !defined(CIPSTER_USE_RECVMMSG)
+    MsgBufPool::Free( s_io_buf );
+    s_io_buf = NULL;
+#endif
 }
 
 
@@ -583,18 +1993,93 @@ EipStatus NetworkHandlerInitialize()
     WSAStartup( wVersionRequested, &wsaData );
 #endif
 
+    // Before any failure can reach NetworkHandlerFinish(), which closes these.
+    s_sockets.tcp_listener = -1;
+    s_sockets.udp_unicast_listener = -1;
+    s_sockets.udp_local_broadcast_listener = -1;
+    s_sockets.udp_global_broadcast_listener = -1;
+
+    s_sockets.udp_unicast_buf           = MsgBufPool::Alloc();
+    s_sockets.udp_local_broadcast_buf   = MsgBufPool::Alloc();
+    s_sockets.udp_global_broadcast_buf  = MsgBufPool::Alloc();
+
+#if !defined(CIPSTER_USE_RECVMMSG)
+    s_io_buf = MsgBufPool::Alloc();
+
+    bool io_buf_ok = s_io_buf != NULL;
+#else
+    bool io_buf_ok = true;
+#endif
+
+    if( !s_sockets.udp_unicast_buf || !s_sockets.udp_local_broadcast_buf ||
+        !s_sockets.udp_global_broadcast_buf || !io_buf_ok )
+    {
+        CIPSTER_TRACE_ERR( "%s: CIPSTER_NUM_MESSAGE_BUFFERS is too small\n", __func__ );
+        freeUdpBufs();
+        return kEipStatusError;
+    }
+
     static const int one = 1;
 
     const CipTcpIpInterfaceConfiguration& c = CipTCPIPInterfaceClass::InterfaceConf(1);
 
+#if defined(CIPSTER_USE_EPOLL)
+    epoll_fd = epoll_create( MAX_EPOLL_EVENTS );    // size is only a hint
+
+    if( epoll_fd == -1 )
+    {
+        CIPSTER_TRACE_ERR( "%s: epoll_create() errno:'%s'\n",
+            __func__, strerrno().c_str() );
+        freeUdpBufs();
+        return kEipStatusError;
+    }
+
+    timer_fd = timerfd_create( CLOCK_MONOTONIC, 0 );
+
+    if( timer_fd == -1 )
+    {
+        CIPSTER_TRACE_ERR( "%s: timerfd_create() errno:'%s'\n",
+            __func__, strerrno().c_str() );
+        goto error;
+    }
+
+    master_set_add( "timer", timer_fd, event_cookie( timer_fd ) );
+
+    trigger_fd = eventfd( 0, EFD_NONBLOCK );
+
+    if( trigger_fd == -1 )
+    {
+        CIPSTER_TRACE_ERR( "%s: eventfd() errno:'%s'\n",
+            __func__, strerrno().c_str() );
+        goto error;
+    }
+
+#if !defined(CIPSTER_WITH_IO_THREAD)
+    master_set_add( "trigger", trigger_fd, event_cookie( trigger_fd ) );
+#endif
+
+#if CIPSTER_MR_WORKERS
+    mr_done_fd = eventfd( 0, EFD_NONBLOCK );
+
+    if( mr_done_fd == -1 )
+    {
+        CIPSTER_TRACE_ERR( "%s: eventfd() errno:'%s'\n",
+            __func__, strerrno().c_str() );
+        goto error;
+    }
+
+    master_set_add( "workers", mr_done_fd, event_cookie( mr_done_fd ) );
+
+    if( CipMessageRouterClass::StartWorkers( mr_done_fd ) != kEipStatusOk )
+        goto error;
+#endif
+#else
     // clear the master and temp sets
     FD_ZERO( &master_set );
     FD_ZERO( &read_set );
-
-    s_sockets.tcp_listener = -1;
-    s_sockets.udp_unicast_listener = -1;
-    s_sockets.udp_local_broadcast_listener = -1;
-    s_sockets.udp_global_broadcast_listener = -1;
+    FD_ZERO( &write_master_set );
+    FD_ZERO( &write_set );
+#endif
 
     //-----<tcp_listener>-------------------------------------------
 
@@ -746,10 +2231,14 @@ EipStatus NetworkHandlerInitialize()
     }
 
     // add the listener socket to the master set
-    master_set_add( "TCP", s_sockets.tcp_listener );
-    master_set_add( "UDP", s_sockets.udp_unicast_listener );
-    master_set_add( "UDP", s_sockets.udp_local_broadcast_listener );
-    master_set_add( "UDP", s_sockets.udp_global_broadcast_listener );
+    master_set_add( "TCP", s_sockets.tcp_listener,
+            event_cookie( s_sockets.tcp_listener ) );
+    master_set_add( "UDP", s_sockets.udp_unicast_listener,
+            event_cookie( s_sockets.udp_unicast_listener ) );
+    master_set_add( "UDP", s_sockets.udp_local_broadcast_listener,
+            event_cookie( s_sockets.udp_local_broadcast_listener ) );
+    master_set_add( "UDP", s_sockets.udp_global_broadcast_listener,
+            event_cookie( s_sockets.udp_global_broadcast_listener ) );
 
     CIPSTER_TRACE_INFO( "%s:\n"
         " tcp_listener                 :%d\n"
@@ -768,6 +2257,11 @@ EipStatus NetworkHandlerInitialize()
     s_sockets.elapsed_time_usecs = 0;
     s_sockets.tcp_inactivity_usecs = 0;
 
+#if defined(CIPSTER_WITH_IO_THREAD)
+    if( startIoThread() != kEipStatusOk )
+        goto error;
+#endif
+
     return kEipStatusOk;
 
 error:
@@ -776,19 +2270,32 @@ error:
 }
 
 
-EipStatus NetworkHandlerProcessOnce()
+EipStatus NetworkHandlerProcessOnce( unsigned aMaxWaitUSecs )
 {
-    read_set = master_set;
+#if defined(CIPSTER_WITH_IO_THREAD)
+    unsigned wait_usecs = explicitWaitUSecs( aMaxWaitUSecs );
+#else
+    unsigned wait_usecs = waitUSecs( aMaxWaitUSecs );
+#endif
+
+#if defined(CIPSTER_USE_EPOLL)
+    epoll_event events[MAX_EPOLL_EVENTS];
+
+    int ready_count = waitEvents( epoll_fd, timer_fd, wait_usecs, events );
+#else
+    read_set  = master_set;
+    write_set = write_master_set;
 
     timeval tv;
 
     // On  Linux,  select()  modifies timeout to reflect the amount of time
     // not slept; most other implementations do not do this.
     // Consider timeout to be undefined after select() returns.
-    tv.tv_sec  = 0;
-    tv.tv_usec = 0;
+    tv.tv_sec  = wait_usecs / 1000000;
+    tv.tv_usec = wait_usecs % 1000000;
 
-    int ready_count = select( highest_socket_handle + 1, &read_set, 0, 0, &tv );
+    int ready_count = select( highest_socket_handle + 1, &read_set, &write_set, 0, &tv );
+#endif
 
     if( ready_count == -1 )
     {
@@ -807,23 +2314,57 @@ EipStatus NetworkHandlerProcessOnce()
         }
     }
 
+#if !defined(CIPSTER_WITH_IO_THREAD)
+    rtPassBegin();
+#endif
+
     if( ready_count > 0 )
     {
+#if defined(CIPSTER_USE_EPOLL)
+        dispatchEvents( events, ready_count );
+#else
         // CIPSTER_TRACE_INFO( "%s: highest_socket_handle:%d ready_count:%d\n",
         //   __func__, highest_socket_handle, ready_count );
 
-        CheckAndHandleTcpListenerSocket();
-        CheckAndHandleUdpUnicastSocket();
-        CheckAndHandleUdpLocalBroadcastSocket();
-        CheckAndHandleUdpGlobalBroadcastSocket();
+        if( checkSocketSet( s_sockets.tcp_listener ) )
+            handleTcpListenerSocket();
+
+        if( checkSocketSet( s_sockets.udp_unicast_listener ) )
+            handleUdpUnicastSocket();
+
+        if( checkSocketSet( s_sockets.udp_local_broadcast_listener ) )
+            handleUdpLocalBroadcastSocket();
+
+        if( checkSocketSet( s_sockets.udp_global_broadcast_listener ) )
+            handleUdpGlobalBroadcastSocket();
+
         checkAndHandleUdpSockets();
 
+        // any socket in write_set is a TCP connection with a transmit queue
+        for( int socket = 0; socket <= highest_socket_handle;  ++socket )
+        {
+            if( FD_ISSET( socket, &write_set ) &&
+                FD_ISSET( socket, &write_master_set ) )
+            {
+                EncapSession* session = SessionMgr::GetSessionBySocket( socket );
+
+                if( !session || kEipStatusError == HandleWritableTcpSocket( session ) )
+                {
+                    CIPSTER_TRACE_INFO( "%s[%d]: calling CloseBySocket()\n",
+                        __func__, socket );
+                    SessionMgr::CloseBySocket( socket );
+                }
+            }
+        }
+
         // if it is still checked it is a TCP receive
         for( int socket = 0; socket <= highest_socket_handle;  ++socket )
         {
             if( checkSocketSet( socket ) )
             {
-                if( kEipStatusError == HandleDataOnTcpSocket( socket ) )
+                EncapSession* session = SessionMgr::GetSessionBySocket( socket );
+
+                if( !session || kEipStatusError == HandleDataOnTcpSocket( session ) )
                 {
                     CIPSTER_TRACE_INFO( "%s[%d]: calling CloseBySocket()\n",
                         __func__, socket );
@@ -831,39 +2372,23 @@ EipStatus NetworkHandlerProcessOnce()
                 }
             }
         }
+#endif
     }
 
+#if defined(CIPSTER_WITH_IO_THREAD)
+    // The I/O thread keeps g_current_usecs and runs ManageConnections(),
+    // this thread sends the ListIdentity replies it delayed.
     unsigned now = usecs_now();
-    unsigned elapsed_usecs = now - s_last_usecs;
-
-    s_last_usecs = now;
 
-    s_sockets.elapsed_time_usecs    += elapsed_usecs;
-    s_sockets.tcp_inactivity_usecs  += elapsed_usecs;
-
-    g_current_usecs += elapsed_usecs;   // accumulate into 64 bits.
-
-    /*  Call ManageConnections() if the elapsed_time_usecs is greater than
-        kCIPsterTimerTickInMicroSeconds.  If more than once cycle
-        was missed, call it more than once so internal time management
-        functions can expect each call to represent kCIPsterTimerTickInMicroSeconds.
-        This will compensate for jitter in how frequently NetworkHandlerProcessOnce()
-        is called.  But please try and call it at least slightly more frequently
-        than every kCIPsterTimerTickInMicroSeconds.
-    */
-    while( s_sockets.elapsed_time_usecs >= kCIPsterTimerTickInMicroSeconds )
-    {
-        ManageConnections();
+    s_sockets.tcp_inactivity_usecs += now - explicit_last_usecs;
+    explicit_last_usecs = now;
 
-        // Since we qualified this in the while() test, this will never go
-        // below zero.
-        s_sockets.elapsed_time_usecs -= kCIPsterTimerTickInMicroSeconds;
-    }
+    ManageEncapsulationMessages();
+#else
+    s_sockets.tcp_inactivity_usecs += advanceClock();
 
-    // process AgeInactivity every 1/2 second.  This is fine because
-    // CipTCPIPInterfaceInstance::inactivity_timeout_secs is in seconds so
-    // respecting the timeout within 1/2 is sufficient.
-    const unsigned INACTIVITY_CHECK_PERIOD_USECS = 500000;
+    rtPassEnd();
+#endif
 
     if( s_sockets.tcp_inactivity_usecs >= INACTIVITY_CHECK_PERIOD_USECS )
     {
@@ -878,15 +2403,237 @@ EipStatus NetworkHandlerProcessOnce()
 
 EipStatus NetworkHandlerFinish()
 {
+#if defined(CIPSTER_WITH_IO_THREAD)
+    stopIoThread();
+#endif
+
+#if CIPSTER_MR_WORKERS
+    CipMessageRouterClass::StopWorkers();
+
+    if( mr_done_fd != -1 )
+    {
+        close( mr_done_fd );
+        mr_done_fd = -1;
+    }
+#endif
+
     CloseSocket( s_sockets.tcp_listener );
     CloseSocket( s_sockets.udp_unicast_listener );
     CloseSocket( s_sockets.udp_local_broadcast_listener );
     CloseSocket( s_sockets.udp_global_broadcast_listener );
 
+    s_sockets.tcp_listener = -1;
+    s_sockets.udp_unicast_listener = -1;
+    s_sockets.udp_local_broadcast_listener = -1;
+    s_sockets.udp_global_broadcast_listener = -1;
+
+    freeUdpBufs();
+
+#if defined(CIPSTER_USE_EPOLL)
+    if( timer_fd != -1 )
+    {
+        close( timer_fd );
+        timer_fd = -1;
+    }
+
+    if( trigger_fd != -1 )
+    {
+        close( trigger_fd );
+        trigger_fd = -1;
+    }
+
+    if( epoll_fd != -1 )
+    {
+        close( epoll_fd );
+        epoll_fd = -1;
+    }
+#endif
+
     return kEipStatusOk;
 }
 
 
+#if defined(CIPSTER_USE_SENDMMSG)
+// Take the next free slot in the batch, flushing it first if full.
+static UdpTxSlot& txSlot( UdpSocket* aUdp, const SockAddr& aAddr )
+{
+    if( tx_count == UDP_TX_BATCH )
+    {
+        UdpTxBatchFlush();
+        tx_batching = true;
+    }
+
+    UdpTxSlot& slot = tx_slots[tx_count++];
+
+    slot.udp    = aUdp;
+    slot.socket = aUdp->h();
+    slot.addr   = aAddr;
+
+    return slot;
+}
+#endif
+
+
+void UdpSocket::Send( const SockAddr& aAddr, const BufReader& aReader )
+{
+#if defined(CIPSTER_USE_SENDMMSG)
+    if( tx_batching && aReader.size() <= CIPSTER_ETHERNET_BUFFER_SIZE )
+    {
+        UdpTxSlot& slot = txSlot( this, aAddr );
+
+        memcpy( slot.buf, aReader.data(), aReader.size() );
+
+        slot.iov[0].iov_base = slot.buf;
+        slot.iov[0].iov_len  = aReader.size();
+        slot.iovcnt = 1;
+        return;
+    }
+#endif
+
+    ::SendUdpData( aAddr, m_socket, aReader );
+}
+
+
+void UdpSocket::Send( const SockAddr& aAddr, const BufReader& aHeader,
+        const BufReader& aData )
+{
+#if defined(CIPSTER_USE_SENDMMSG)
+    if( tx_batching )
+    {
+        UdpTxSlot& slot = txSlot( this, aAddr );
+
+        slot.iov[0].iov_base = (void*) aHeader.data();
+        slot.iov[0].iov_len  = aHeader.size();
+        slot.iov[1].iov_base = (void*) aData.data();
+        slot.iov[1].iov_len  = aData.size();
+        slot.iovcnt = 2;
+        return;
+    }
+#endif
+
+#if defined(_WIN32)
+    static uint8_t  gathered[CIPSTER_ETHERNET_BUFFER_SIZE];
+
+    BufWriter   out( gathered, sizeof gathered );
+
+    out.append( aHeader );
+    out.append( aData );
+
+    ::SendUdpData( aAddr, m_socket, BufReader( gathered, out.data() - gathered ) );
+#else
+    struct iovec    iov[2];
+    msghdr          hdr;
+
+    iov[0].iov_base = (void*) aHeader.data();
+    iov[0].iov_len  = aHeader.size();
+    iov[1].iov_base = (void*) aData.data();
+    iov[1].iov_len  = aData.size();
+
+    memset( &hdr, 0, sizeof hdr );
+
+    hdr.msg_name    = (sockaddr*) aAddr;
+    hdr.msg_namelen = SADDRZ;
+    hdr.msg_iov     = iov;
+    hdr.msg_iovlen  = 2;
+
+    int sent_count = sendmsg( m_socket, &hdr, 0 );
+
+    if( sent_count < 0 )
+    {
+        socket_error se;
+
+        CIPSTER_TRACE_ERR( "%s[%d]: sendmsg(): '%s'\n",
+                __func__, m_socket, se.what() );
+
+        throw se;
+    }
+
+    if( sent_count != aHeader.size() + aData.size() )
+    {
+        std::string msg = StrPrintf(
+                "%s[%d]: data_length != sent_count mismatch, sent %d of %d\n",
+                __func__, m_socket, sent_count, int( aHeader.size() + aData.size() ) );
+
+        // Since the OS probably has no "errno" for this situation, we use -1.
+        socket_error se( msg, -1 );
+        throw se;
+    }
+#endif
+}
+
+
+void UdpTxBatchBegin()
+{
+#if defined(CIPSTER_USE_SENDMMSG)
+    tx_batching = true;
+#endif
+}
+
+
+void UdpTxBatchFlush()
+{
+#if defined(CIPSTER_USE_SENDMMSG)
+    tx_batching = false;
+
+    // Send the held datagrams in order, grouping all those for one socket
+    // into a single sendmmsg().  Usually every producing connection shares
+    // the one socket bound to kEIP_IoUdpPort.
+    for( int first = 0;  first < tx_count;  ++first )
+    {
+        int socket = tx_slots[first].socket;
+
+        if( socket == kSocketInvalid )
+            continue;           // already sent with an earlier group
+
+        int count = 0;
+
+        for( int i = first;  i < tx_count;  ++i )
+        {
+            UdpTxSlot& slot = tx_slots[i];
+
+            if( slot.socket != socket )
+                continue;
+
+            slot.socket = kSocketInvalid;
+
+            // skip it if the socket was closed after this was queued
+            if( slot.udp->h() != socket )
+                continue;
+
+            msghdr& hdr = tx_msgs[count].msg_hdr;
+
+            hdr.msg_name        = &slot.addr;
+            hdr.msg_namelen     = sizeof slot.addr;
+            hdr.msg_iov         = slot.iov;
+            hdr.msg_iovlen      = slot.iovcnt;
+            hdr.msg_control     = NULL;
+            hdr.msg_controllen  = 0;
+            hdr.msg_flags       = 0;
+
+            ++count;
+        }
+
+        for( int sent = 0;  sent < count;  )
+        {
+            int r = sendmmsg( socket, tx_msgs + sent, count - sent, 0 );
+
+            if( r <= 0 )
+            {
+                CIPSTER_TRACE_ERR( "%s[%d]: sendmmsg(): '%s'\n",
+                        __func__, socket, strerrno().c_str() );
+
+                ++sent;         // drop the one which failed, try the rest
+            }
+            else
+                sent += r;
+        }
+    }
+
+    tx_count = 0;
+#endif
+}
+
+
 void SendUdpData( const SockAddr& aSockAddr, int aSocket, BufReader aOutput )
 {
     int sent_count = sendto( aSocket, (char*) aOutput.data(), aOutput.size(), 0,
@@ -953,6 +2700,8 @@ UdpSocket* UdpSocketMgr::GrabSocket( const SockAddr& aSockAddr, const SockAddr*
         iface = alloc( aSockAddr, sock );
         m_sockets.push_back( iface );
 
+        master_set_add( "UDP", sock, event_cookie( iface, kEventUdp ) );
+
         //CIPSTER_TRACE_INFO( "%s: alloc %s:%d\n", __func__, aSockAddr.AddrStr().c_str(), aSockAddr.Port() );
     }
 
@@ -1186,6 +2935,19 @@ int UdpSocketMgr::createSocket( const SockAddr& aSockAddr )
 
     CIPSTER_TRACE_INFO( "%s[%d]: bound on %s\n", __func__, udp_sock, aSockAddr.Format().c_str() );
 
+#if defined(CIPSTER_USE_RX_TIMESTAMPS)
+    {
+        int one = 1;
+
+        // Without them frames are taken to arrive when read, so carry on.
+        if( setsockopt( udp_sock, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof one ) )
+        {
+            CIPSTER_TRACE_WARN( "%s[%d]: SO_TIMESTAMPNS errno: '%s'\n",
+                __func__, udp_sock, strerrno().c_str() );
+        }
+    }
+#endif
+
     {
         char ttl = CipTCPIPInterfaceClass::TTL(1);
         if( 1 != ttl )
@@ -1202,8 +2964,6 @@ int UdpSocketMgr::createSocket( const SockAddr& aSockAddr )
         }
     }
 
-    master_set_add( "UDP", udp_sock );
-
 exit:
     return udp_sock;
 
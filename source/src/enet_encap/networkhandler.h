@@ -9,20 +9,158 @@
 
 #include <string>
 
+#include <cipster_user_conf.h>
 #include "sockaddr.h"
 #include "../cip/ciptypes.h"
 
 
+/**
+ * The count of message buffers in the MsgBufPool.  Each TCP connection owns
+ * one while open, as does each of the three encapsulation UDP sockets and the
+ * I/O receive path when it is without recvmmsg().  So this bounds the memory
+ * for messages, and a count smaller than the default also bounds the number
+ * of TCP connections.
+ */
+#if !defined(CIPSTER_NUM_MESSAGE_BUFFERS)
+ #define CIPSTER_NUM_MESSAGE_BUFFERS    (CIPSTER_NUMBER_OF_SUPPORTED_SESSIONS + 4)
+#endif
+
+
+/**
+ * The count of unsent reply bytes at which a TCP connection's transmit queue
+ * stops the stack from reading more requests on that connection, until the
+ * client has taken enough of the queue to bring it back below this.
+ */
+#if !defined(CIPSTER_TCP_TX_HIGH_WATER)
+ #define CIPSTER_TCP_TX_HIGH_WATER      (2 * CIPSTER_ETHERNET_BUFFER_SIZE)
+#endif
+
+
+/**
+ * Class MsgBufPool
+ * hands out buffers of CIPSTER_ETHERNET_BUFFER_SIZE bytes, each for receiving
+ * messages and building their replies, from a fixed pool of
+ * CIPSTER_NUM_MESSAGE_BUFFERS.
+ */
+class MsgBufPool
+{
+public:
+    enum { kBufSize = CIPSTER_ETHERNET_BUFFER_SIZE };
+
+    /// Take a buffer, or return NULL if all are in use.
+    static uint8_t* Alloc();
+
+    /// Give back a buffer from Alloc(), NULL is ignored.
+    static void Free( uint8_t* aBuf );
+
+private:
+    static uint8_t  bufs[CIPSTER_NUM_MESSAGE_BUFFERS][kBufSize];
+    static uint8_t* free_list[CIPSTER_NUM_MESSAGE_BUFFERS];
+    static int      free_count;
+    static bool     initialized;
+};
+
+
 /**
  * Function NetworkHandlerInitialize
  * starts a TCP/UDP listening socket to accept connections.
  */
 EipStatus NetworkHandlerInitialize();
 
-EipStatus NetworkHandlerProcessOnce();
+/**
+ * Function NetworkHandlerProcessOnce
+ * services the sockets which are ready and runs ManageConnections() for
+ * each timer tick which has elapsed.
+ *
+ * @param aMaxWaitUSecs is the longest time to block waiting for a socket to
+ *  become ready.  The wait also ends at the stack's next timer deadline, i.e.
+ *  a connection's transmission trigger or inactivity watchdog, a delayed
+ *  ListIdentity reply, or the TCP inactivity check.  So a large value lets an
+ *  otherwise idle event loop sleep rather than spin.  Zero polls and returns
+ *  at once.  Since HandleApplication() is only called from ManageConnections(),
+ *  an application needing it on every tick should pass no more than
+ *  kCIPsterTimerTickInMicroSeconds.
+ *
+ *  When built with CIPSTER_WITH_IO_THREAD, NetworkHandlerInitialize() starts
+ *  an I/O thread which reads the I/O connections' UDP sockets and runs
+ *  ManageConnections() on every tick by itself, and so HandleApplication()
+ *  and the assembly callbacks are called on that thread.  This function then
+ *  only serves the explicit messaging: the TCP connections, the encapsulation
+ *  UDP sockets and the TCP inactivity check.  Requests to the assembly,
+ *  connection and connection manager objects are performed on the I/O thread
+ *  by IoThreadCall(), while this thread waits.
+ */
+EipStatus NetworkHandlerProcessOnce( unsigned aMaxWaitUSecs = 0 );
 
 EipStatus NetworkHandlerFinish();
 
+/**
+ * Function IoThreadCall
+ * runs @a aFunc( @a aArg ) on the I/O thread and returns once it has,
+ * rethrowing anything it threw.  Without CIPSTER_WITH_IO_THREAD, or when
+ * already on the I/O thread, it is simply called.  This is how the explicit
+ * thread reaches the connections and assemblies which the I/O thread owns.
+ */
+void IoThreadCall( void (*aFunc)( void* ), void* aArg );
+
+/**
+ * Function ExplicitThreadPost
+ * has @a aFunc( @a aArg ) run by the thread calling NetworkHandlerProcessOnce()
+ * without waiting for it, when called on the I/O thread.  Otherwise it is
+ * simply called.  This is how the I/O thread reaches the sessions.
+ */
+void ExplicitThreadPost( void (*aFunc)( void* ), void* aArg );
+
+/**
+ * Function NetworkHandlerWake
+ * ends the wait of the thread running ManageConnections() so it takes the
+ * assemblies given to NotifyAssemblyChanged() at once.  Async signal safe.
+ */
+void NetworkHandlerWake();
+
+/**
+ * Struct RealTimeStats
+ * counts what the thread driving the I/O connections suffered while servicing
+ * sockets and timers, but not while waiting for them.  Once a real time setup
+ * has warmed up the faults and the involuntary switches should stay at zero.
+ */
+struct RealTimeStats
+{
+    uint64_t    passes;                 ///< servicing passes counted
+    uint64_t    minor_faults;           ///< page faults served without I/O
+    uint64_t    major_faults;           ///< page faults which waited on I/O
+    uint64_t    voluntary_switches;     ///< blocked mid pass, e.g. on a lock
+    uint64_t    involuntary_switches;   ///< preempted mid pass
+};
+
+/**
+ * Function NetworkHandlerRealTime
+ * puts the thread driving the I/O connections in real time execution, and
+ * starts counting its RealTimeStats.  That is the I/O thread when built with
+ * CIPSTER_WITH_IO_THREAD, else the thread calling NetworkHandlerProcessOnce(),
+ * which must be the one calling this, after NetworkHandlerInitialize().
+ * Linux only, since CIPster has no real time support elsewhere.
+ *
+ * @param aPriority is the SCHED_FIFO priority from 1 to 99, or 0 to leave
+ *  the scheduling as it is.
+ * @param aCpu is the only CPU the thread may run on, or -1 for any.
+ * @param aLockMemory when true locks the process' memory, now and as it
+ *  grows, with mlockall().  That faults in all of the static message buffers
+ *  and connection pools, and this also prefaults the thread's stack and a
+ *  reserve of heap which malloc() then keeps rather than gives back.
+ * @return EipStatus - kEipStatusError if any of it failed, usually for lack
+ *  of privilege, having done what it could.
+ */
+EipStatus NetworkHandlerRealTime( int aPriority, int aCpu = -1, bool aLockMemory = true );
+
+/**
+ * Function NetworkHandlerRealTimeStats
+ * copies the RealTimeStats counted since NetworkHandlerRealTime() or the
+ * last reset to @a aStats, all zero if not in real time execution.
+ * @param aReset when true starts counting over.
+ */
+void NetworkHandlerRealTimeStats( RealTimeStats* aStats, bool aReset = false );
+
 /**
  * Function CloseSocket
  * closes @a aSocket
@@ -44,6 +182,22 @@ bool SocketAsync( int aSocket, bool isAsync = true );
  */
 void SendUdpData( const SockAddr& aSockAddr, int aSocket, BufReader aOutput );
 
+/**
+ * Function UdpTxBatchBegin
+ * starts holding the datagrams given to UdpSocket::Send() in a ring of
+ * buffers, rather than sending each one at once, until UdpTxBatchFlush().
+ * Only Linux holds them, elsewhere Send() always sends at once.
+ */
+void UdpTxBatchBegin();
+
+/**
+ * Function UdpTxBatchFlush
+ * sends the datagrams held since UdpTxBatchBegin() using one sendmmsg()
+ * per socket, and stops holding.  Send errors are logged here since they
+ * can no longer reach the caller of UdpSocket::Send().
+ */
+void UdpTxBatchFlush();
+
 
 /**
  * Class UdpSocket
@@ -74,13 +228,23 @@ public:
 
     /**
      * Function Send
-     * send a packet on UDP.
-     * @throw socket_error if a problem sending
+     * send a packet on UDP, or copies it for UdpTxBatchFlush() to send
+     * when within a batch.
+     * @throw socket_error if a problem sending at once.  Within a batch
+     *  nothing is sent here, and UdpTxBatchFlush() only logs send errors.
      */
-    void Send( const SockAddr& aAddr, const BufReader& aReader )
-    {
-        ::SendUdpData( aAddr, m_socket, aReader );
-    }
+    void Send( const SockAddr& aAddr, const BufReader& aReader );
+
+    /**
+     * Function Send
+     * sends @a aHeader followed by @a aData as one datagram, gathered by
+     * sendmsg() so neither is copied in user space.  Within a batch both
+     * must stay put and unchanged until UdpTxBatchFlush().
+     * @throw socket_error if a problem sending at once.  Within a batch
+     *  nothing is sent here, and UdpTxBatchFlush() only logs send errors.
+     */
+    void Send( const SockAddr& aAddr, const BufReader& aHeader,
+            const BufReader& aData );
 
     int Recv( SockAddr* aAddr, const BufWriter& aWriter )
     {
@@ -0,0 +1,72 @@
+/*******************************************************************************
+ * Copyright (C) 2016-2018, SoftPLC Corporation.
+ *
+ ******************************************************************************/
+
+#ifndef CIPSTER_SPSC_QUEUE_H_
+#define CIPSTER_SPSC_QUEUE_H_
+
+#include <atomic>
+
+
+/**
+ * Class SpscQueue
+ * is a bounded lock-free FIFO of @a N items of type T, for exactly one
+ * producing thread and one consuming thread.  N must be a power of 2.
+ */
+template< typename T, unsigned N >
+class SpscQueue
+{
+public:
+    SpscQueue() :
+        head( 0 ),
+        tail( 0 )
+    {}
+
+    /**
+     * Function Push
+     * appends @a aItem, and may only be called by the producing thread.
+     * @return bool - false if the queue was full.
+     */
+    bool Push( const T& aItem )
+    {
+        unsigned t = tail.load( std::memory_order_relaxed );
+
+        if( t - head.load( std::memory_order_acquire ) == N )
+            return false;
+
+        items[t & (N-1)] = aItem;
+
+        tail.store( t + 1, std::memory_order_release );
+        return true;
+    }
+
+    /**
+     * Function Pop
+     * takes the oldest item into @a aItem, and may only be called by the
+     * consuming thread.
+     * @return bool - false if the queue was empty.
+     */
+    bool Pop( T* aItem )
+    {
+        unsigned h = head.load( std::memory_order_relaxed );
+
+        if( h == tail.load( std::memory_order_acquire ) )
+            return false;
+
+        *aItem = items[h & (N-1)];
+
+        head.store( h + 1, std::memory_order_release );
+        return true;
+    }
+
+private:
+    static_assert( N && !( N & (N-1) ), "N must be a power of 2" );
+
+    std::atomic<unsigned>   head;   // next to Pop(), only the consumer stores
+    std::atomic<unsigned>   tail;   // next to Push(), only the producer stores
+
+    T           items[N];
+};
+
+#endif // CIPSTER_SPSC_QUEUE_H_
@@ -0,0 +1,93 @@
+/*******************************************************************************
+ * Copyright (C) 2016-2018, SoftPLC Corporation.
+ *
+ ******************************************************************************/
+
+#ifndef CIPSTER_TRIPLE_BUF_H_
+#define CIPSTER_TRIPLE_BUF_H_
+
+#include <string.h>
+#include <atomic>
+#include <vector>
+
+
+/**
+ * Class TripleBuf
+ * is three images of the same size, for exactly one writing thread and one
+ * reading thread, without locks.  The writer fills its own image then
+ * publishes it, the reader takes the newest published image as its own.
+ * Neither ever waits, and the reader's image is always a complete one.
+ */
+class TripleBuf
+{
+public:
+    /// Give each image a copy of the @a aSize bytes at @a aInit.
+    TripleBuf( const uint8_t* aInit, unsigned aSize ) :
+        bytes( 3 * aSize ),
+        size( aSize ),
+        back( 0 ),
+        published( 1 ),
+        front( 2 ),
+        middle( 1 )
+    {
+        for( int i = 0; i < 3;  ++i )
+            memcpy( image( i ), aInit, aSize );
+    }
+
+    unsigned Size() const           { return size; }
+
+    /// The image the writer fills before Publish().
+    uint8_t* Back()                 { return image( back ); }
+
+    /// The image last given to Publish(), which the writer may still read.
+    uint8_t* Published()            { return image( published ); }
+
+    /**
+     * Function Publish
+     * makes the writer's Back() the newest image, and gives the writer
+     * another one to fill.  May only be called by the writing thread.
+     */
+    void Publish()
+    {
+        published = back;
+        back = middle.exchange( back | kFresh, std::memory_order_acq_rel ) & kIndex;
+    }
+
+    /**
+     * Function Acquire
+     * makes the newest published image the reader's Front(), if there is a
+     * newer one than that.  May only be called by the reading thread.
+     * @return bool - true if Front() changed.
+     */
+    bool Acquire()
+    {
+        if( !( middle.load( std::memory_order_relaxed ) & kFresh ) )
+            return false;
+
+        front = middle.exchange( front, std::memory_order_acq_rel ) & kIndex;
+        return true;
+    }
+
+    /// The reader's image, which stays put until its next Acquire().
+    uint8_t* Front()                { return image( front ); }
+
+private:
+    enum
+    {
+        kIndex = 3,                     // bits holding an image index
+        kFresh = 4,                     // middle is newer than front
+    };
+
+    uint8_t* image( unsigned aIndex )   { return &bytes[aIndex * size]; }
+
+    std::vector<uint8_t>    bytes;
+    unsigned                size;
+
+    unsigned                back;       // only the writer touches
+    unsigned                published;  // only the writer touches
+    unsigned                front;      // only the reader touches
+
+    std::atomic<unsigned>   middle;     // index of the spare, plus kFresh
+};
+
+#endif // CIPSTER_TRIPLE_BUF_H_
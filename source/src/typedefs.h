@@ -62,6 +62,7 @@ enum EipStatus
 {
     kEipStatusOk      = 0,
     kEipStatusOkSend  = 1,
+    kEipStatusPending = 2,      ///< NotifyMR() gave the service to a worker thread
     kEipStatusError   = -1,
 };
 
@@ -0,0 +1,243 @@
+/*******************************************************************************
+ * Copyright (c) 2026, SoftPLC Corporation.
+ *
+ * Standalone, dependency-free regression test for the replay of the cached
+ * reply to a retransmitted Class 3 request.
+ *
+ * Background: an originator which loses the reply to a Class 3 request sends
+ * it again with the same sequence count (Vol1 3-4.4.5).  Performing it again
+ * would run a non-idempotent service, say a Set which bumps a counter, twice.
+ * Cpf::NotifyConnectedCommonPacketFormat() instead answers a request which
+ * repeats the sequence count of the one before it with the bytes it sent the
+ * first time, kept by CipConn::SetClass3Reply().
+ *
+ * This test pins down that:
+ *   1. a repeated sequence count gets the very same reply bytes and the
+ *      service is not performed again;
+ *   2. a new sequence count is performed, and so is one repeating an older
+ *      count than the one before it;
+ *   3. a connection cleared and opened again does not replay what its
+ *      previous life sent.
+ *
+ * The service is one of a vendor specific class which counts its calls, and
+ * the explicit connection is put into g_active_conns as a Forward Open would.
+ *
+ * Like its siblings it avoids the (unbuilt) CppUTest harness: it links only
+ * against the eip library and reports via the process exit code.
+ ******************************************************************************/
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <cipster_api.h>
+#include <cipclass.h>
+#include <cipconnection.h>
+#include <cipconnectionmanager.h>
+#include <cipmessagerouter.h>
+#include <byte_bufs.h>
+#include "../../src/enet_encap/cpf.h"
+
+
+static int g_checks = 0;
+static int g_fail   = 0;
+
+#define CHECK( cond )                                                       \
+    do {                                                                    \
+        ++g_checks;                                                         \
+        if( !(cond) ) {                                                     \
+            ++g_fail;                                                       \
+            printf( "  FAIL %s:%d   %s\n", __FILE__, __LINE__, #cond );     \
+        }                                                                   \
+    } while( 0 )
+
+
+enum
+{
+    kCounterClass   = 0x64,     // vendor specific
+    kCountService   = 0x4b,     // class specific
+    kConsumingId    = 0x30000001,
+    kProducingId    = 0x40000001,
+};
+
+static int      s_count;
+
+
+/// Counts its calls and replies with the count so far.
+static EipStatus count_service( CipInstance* aInstance,
+        CipMessageRouterRequest* aRequest, CipMessageRouterResponse* aResponse )
+{
+    ++s_count;
+
+    BufWriter out = aResponse->Writer();
+
+    out.put16( s_count );
+    aResponse->SetWrittenSize( 2 );
+
+    return kEipStatusOkSend;
+}
+
+
+static void register_counter()
+{
+    CipClass* clazz = new CipClass( kCounterClass, "Counter", 0 );
+
+    clazz->ServiceInsert( CipInstance::_I, kCountService, count_service, "Count" );
+    clazz->InstanceInsert( new CipInstance( 1 ) );
+
+    CHECK( RegisterCipClass( clazz ) == kEipStatusOk );
+}
+
+
+static CipConn  s_conn;
+
+
+static void open_conn()
+{
+    s_conn.SetInstanceType( kConnInstanceTypeExplicit );
+    s_conn.SetConsumingConnectionId( kConsumingId );
+    s_conn.SetProducingConnectionId( kProducingId );
+    s_conn.SetExpectedPacketRateUSecs( 10000000 );
+    s_conn.SetState( kConnStateEstablished );
+
+    CHECK( g_active_conns.Insert( &s_conn ) );
+}
+
+
+static void close_conn()
+{
+    CHECK( g_active_conns.Remove( &s_conn ) );
+    s_conn.Clear();
+}
+
+
+/// Sends the Count service on the connection with sequence count @a aSeq,
+/// and returns the reply bytes, empty if there were none.
+static std::vector<uint8_t> send( uint16_t aSeq, CipUdint aCid = kConsumingId )
+{
+    static const uint8_t request[] = { kCountService, 0x02, 0x20, kCounterClass, 0x24, 0x01 };
+
+    uint8_t     command[64];
+    BufWriter   w( command, sizeof command );
+
+    w.put16( 2 );                               // item count
+    w.put16( kCpfIdConnectedAddress );
+    w.put16( 4 );
+    w.put32( aCid );
+    w.put16( kCpfIdConnectedDataItem );
+    w.put16( 2 + sizeof request );
+    w.put16( aSeq );
+    w.append( BufReader( request, sizeof request ) );
+
+    uint8_t reply[256];
+
+    memset( reply, 0xee, sizeof reply );
+
+    Cpf cpf( kCpfIdConnectedAddress, kCpfIdConnectedDataItem );
+
+    int result = cpf.NotifyConnectedCommonPacketFormat(
+                    BufReader( command, w.data() - command ),
+                    BufWriter( reply, sizeof reply ) );
+
+    if( result <= 0 )
+        return std::vector<uint8_t>();
+
+    return std::vector<uint8_t>( reply, reply + result );
+}
+
+
+static void test_replay()
+{
+    printf( "Class 3: a repeated sequence count is replayed, not performed again\n" );
+
+    s_count = 0;
+    open_conn();
+
+    std::vector<uint8_t> first = send( 1 );
+
+    CHECK( s_count == 1 );
+    CHECK( first.size() > 0 );
+
+    std::vector<uint8_t> again = send( 1 );
+
+    CHECK( s_count == 1 );
+    CHECK( again == first );
+
+    // The reply carries the count, so a fresh one differs from the cached.
+    std::vector<uint8_t> next = send( 2 );
+
+    CHECK( s_count == 2 );
+    CHECK( next.size() == first.size() );
+    CHECK( next != first );
+
+    CHECK( send( 2 ) == next );
+    CHECK( s_count == 2 );
+
+    // Only the one just before is cached.
+    send( 1 );
+
+    CHECK( s_count == 3 );
+
+    // An unknown connection id is refused, and disturbs nothing.
+    CHECK( send( 1, kConsumingId + 1 ).empty() );
+    CHECK( s_count == 3 );
+
+    close_conn();
+}
+
+
+static void test_reopened()
+{
+    printf( "Class 3: a connection opened again forgets the replies of its last life\n" );
+
+    s_count = 0;
+    open_conn();
+
+    send( 7 );
+
+    CHECK( s_count == 1 );
+
+    close_conn();
+
+    CHECK( send( 7 ).empty() );
+    CHECK( s_count == 1 );
+
+    open_conn();
+
+    send( 7 );
+
+    CHECK( s_count == 2 );
+
+    close_conn();
+}
+
+
+// ---- Application callbacks the eip library expects an adapter app to provide ----
+// This test is not a running adapter, so they are inert stubs that merely satisfy the
+// linker.  None of them are reached by the tests above.
+EipStatus AfterAssemblyDataReceived( AssemblyInstance*, OpMode, int ) { return kEipStatusOk; }
+bool      BeforeAssemblyDataSend( AssemblyInstance* )                 { return false; }
+void      NotifyIoConnectionEvent( CipConn*, IoConnectionEvent )      {}
+void      RunIdleChanged( uint32_t )                                  {}
+void      HandleApplication()                                         {}
+EipStatus ResetDevice()                                               { return kEipStatusOk; }
+EipStatus ResetDeviceToInitialConfiguration( bool )                   { return kEipStatusOk; }
+
+
+int main()
+{
+    CipStackInit( 1 );
+
+    register_counter();
+
+    test_replay();
+    test_reopened();
+
+    ShutdownCipStack();
+
+    printf( "%s: %d checks, %d failure(s)\n",
+            g_fail ? "FAILED" : "PASSED", g_checks, g_fail );
+
+    return g_fail ? 1 : 0;
+}
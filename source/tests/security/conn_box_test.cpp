@@ -0,0 +1,329 @@
+/*******************************************************************************
+ * Copyright (c) 2026, SoftPLC Corporation.
+ *
+ * Standalone, dependency-free regression test for CipConnBox, the container of
+ * active connections.
+ *
+ * Background: besides the doubly linked active list, CipConnBox keeps the
+ * connections having a running timer in a binary min heap keyed on the
+ * earliest of their inactivity watchdog and transmission trigger deadlines,
+ * and chains them in a hash on consuming connection id.  ManageConnections()
+ * visits only what PopExpired() hands it, and every received packet is routed
+ * by FindByConsumingId(), so a heap out of order delays or misses a timeout,
+ * and a broken chain loses a connection's traffic or keeps a closed one.
+ *
+ * This test pins down that:
+ *   1. PopExpired() hands out connections in deadline order, also across a
+ *      wrap of the 32 bit usecs clock, and only those which are due;
+ *   2. a timer moved earlier requeues its connection at once, one moved later
+ *      is found stale on expiry and requeued by QueueTimers();
+ *   3. Remove() from the middle of the heap leaves the rest in order;
+ *   4. FindByConsumingId() finds every connection on a shared chain, the
+ *      newest of a duplicated id first, and none once removed.
+ *
+ * Connections are given a watchdog by making them servers with an RPI.
+ * CipConn::requeueTimers() works on g_active_conns, so that is the box used.
+ *
+ * Like its siblings it avoids the (unbuilt) CppUTest harness: it links only
+ * against the eip library and reports via the process exit code.
+ ******************************************************************************/
+
+#include <cstdio>
+#include <cstdint>
+
+#include <cipster_api.h>
+#include <cipconnection.h>
+#include <cipconnectionmanager.h>
+
+
+static int g_checks = 0;
+static int g_fail   = 0;
+
+#define CHECK( cond )                                                       \
+    do {                                                                    \
+        ++g_checks;                                                         \
+        if( !(cond) ) {                                                     \
+            ++g_fail;                                                       \
+            printf( "  FAIL %s:%d   %s\n", __FILE__, __LINE__, #cond );     \
+        }                                                                   \
+    } while( 0 )
+
+
+enum { kConnCount = 100 };      // more than there are hash buckets
+
+static CipConn  s_conns[kConnCount];
+
+// Just short of the wrap of CurrentUSecs32(), so the deadlines straddle it.
+static const uint64_t kStartUSecs = 0xffffff00u;
+
+
+/// Readies @a aConn to be a server with a running inactivity watchdog
+/// @a aDeadline usecs after kStartUSecs.
+static void prepare( CipConn* aConn, CipUdint aCid, int32_t aDeadline )
+{
+    g_current_usecs = kStartUSecs;
+
+    aConn->Transport().SetServer( true );
+    aConn->SetExpectedPacketRateUSecs( 10000 );
+    aConn->SetConsumingConnectionId( aCid );
+    aConn->SetState( kConnStateEstablished );
+    aConn->SetInactivityWatchDogTimerUSecs( aDeadline );
+}
+
+
+/// Deadline of connection @a i, a permutation of 0..kConnCount-1 in
+/// steps of 10 usecs, so none are equal and they are not inserted in order.
+static int32_t deadline( int i )
+{
+    return ( i * 37 % kConnCount ) * 10;
+}
+
+
+static void insert_all()
+{
+    for( int i = 0; i < kConnCount;  ++i )
+    {
+        prepare( &s_conns[i], 0x1000 + i, deadline( i ) );
+        CHECK( g_active_conns.Insert( &s_conns[i] ) );
+    }
+}
+
+
+static void remove_all()
+{
+    for( int i = 0; i < kConnCount;  ++i )
+    {
+        if( g_active_conns.Remove( &s_conns[i] ) )
+            s_conns[i].SetState( kConnStateNonExistent );
+    }
+
+    g_current_usecs = kStartUSecs;
+}
+
+
+static void test_heap_order()
+{
+    printf( "CipConnBox: PopExpired() hands out due connections in deadline order\n" );
+
+    insert_all();
+
+    CHECK( g_active_conns.NextTimerUSecs( uint32_t( kStartUSecs ), 1000000 ) == 0 );
+    CHECK( g_active_conns.NextTimerUSecs( uint32_t( kStartUSecs ), -5 ) == -5 );
+
+    // Nothing is due before the earliest deadline.
+    CHECK( g_active_conns.PopExpired( uint32_t( kStartUSecs ) - 1 ) == NULL );
+
+    uint32_t    now = uint32_t( kStartUSecs + 10 * kConnCount );
+    int32_t     last = -1;
+    int         popped = 0;
+
+    while( CipConn* c = g_active_conns.PopExpired( now ) )
+    {
+        int32_t at = deadline( c - s_conns );
+
+        CHECK( at > last );
+        last = at;
+        ++popped;
+    }
+
+    CHECK( popped == kConnCount );
+    CHECK( g_active_conns.NextTimerUSecs( now, 1234 ) == 1234 );
+
+    remove_all();
+}
+
+
+static void test_due_only()
+{
+    printf( "CipConnBox: only the connections due are popped, across the clock wrap\n" );
+
+    insert_all();
+
+    // kStartUSecs + 500 is past the wrap of the 32 bit clock.
+    uint32_t    now = uint32_t( kStartUSecs + 500 );
+    int         popped = 0;
+
+    CHECK( now < uint32_t( kStartUSecs ) );
+
+    while( g_active_conns.PopExpired( now ) )
+        ++popped;
+
+    CHECK( popped == 51 );      // deadlines 0 through 500
+    CHECK( g_active_conns.NextTimerUSecs( now, 1000000 ) == 10 );
+
+    remove_all();
+}
+
+
+static void test_requeue()
+{
+    printf( "CipConnBox: an earlier timer requeues at once, a later one on expiry\n" );
+
+    insert_all();
+
+    // Connection 0 has deadline 0, the earliest, move it later.
+    CipConn* first = &s_conns[0];
+
+    CHECK( deadline( 0 ) == 0 );
+
+    first->SetInactivityWatchDogTimerUSecs( 5000 );
+
+    // Its stale entry is still at the top and is handed out at the old time.
+    CHECK( g_active_conns.NextTimerUSecs( uint32_t( kStartUSecs ), 1000000 ) == 0 );
+    CHECK( g_active_conns.PopExpired( uint32_t( kStartUSecs ) ) == first );
+
+    // Not yet due, so it goes back in on its current deadline, the latest.
+    g_active_conns.QueueTimers( first );
+
+    uint32_t    now = uint32_t( kStartUSecs + 10 * kConnCount );
+    CipConn*    c;
+
+    while( ( c = g_active_conns.PopExpired( now ) ) != NULL )
+        CHECK( c != first );
+
+    CHECK( g_active_conns.NextTimerUSecs( now, 1000000 ) == 5000 - 10 * kConnCount );
+
+    remove_all();
+
+    insert_all();
+
+    // Move the connection with the latest deadline to the front.
+    CipConn* latest = NULL;
+
+    for( int i = 0; i < kConnCount;  ++i )
+        if( deadline( i ) == 10 * ( kConnCount - 1 ) )
+            latest = &s_conns[i];
+
+    CHECK( latest != NULL );
+
+    latest->SetInactivityWatchDogTimerUSecs( -100 );
+
+    CHECK( g_active_conns.NextTimerUSecs( uint32_t( kStartUSecs ), 1000000 ) == -100 );
+    CHECK( g_active_conns.PopExpired( uint32_t( kStartUSecs ) - 100 ) == latest );
+    CHECK( g_active_conns.PopExpired( uint32_t( kStartUSecs ) - 100 ) == NULL );
+
+    // Given back with no timer running it stays out of the queue.
+    latest->SetExpectedPacketRateUSecs( 0 );
+    g_active_conns.QueueTimers( latest );
+
+    int popped = 0;
+
+    while( ( c = g_active_conns.PopExpired( now ) ) != NULL )
+    {
+        CHECK( c != latest );
+        ++popped;
+    }
+
+    CHECK( popped == kConnCount - 1 );
+
+    remove_all();
+}
+
+
+static void test_remove_keeps_order()
+{
+    printf( "CipConnBox: Remove() from within the heap leaves the rest in order\n" );
+
+    insert_all();
+
+    for( int i = 0; i < kConnCount;  i += 3 )
+        CHECK( g_active_conns.Remove( &s_conns[i] ) );
+
+    CHECK( !g_active_conns.Remove( &s_conns[0] ) );
+
+    uint32_t    now = uint32_t( kStartUSecs + 10 * kConnCount );
+    int32_t     last = -1;
+    int         popped = 0;
+
+    while( CipConn* c = g_active_conns.PopExpired( now ) )
+    {
+        int index = c - s_conns;
+
+        CHECK( index % 3 != 0 );
+
+        int32_t at = deadline( index );
+
+        CHECK( at > last );
+        last = at;
+        ++popped;
+    }
+
+    CHECK( popped == kConnCount - ( kConnCount + 2 ) / 3 );
+
+    remove_all();
+}
+
+
+static void test_cid_hash()
+{
+    printf( "CipConnBox: FindByConsumingId() survives removal from a shared chain\n" );
+
+    insert_all();
+
+    for( int i = 0; i < kConnCount;  ++i )
+        CHECK( g_active_conns.FindByConsumingId( 0x1000 + i ) == &s_conns[i] );
+
+    CHECK( g_active_conns.FindByConsumingId( 0x1000 + kConnCount ) == NULL );
+
+    // With more connections than buckets some chains are shared, so removing
+    // every other one takes some from the head, middle and tail of a chain.
+    for( int i = 0; i < kConnCount;  i += 2 )
+        g_active_conns.Remove( &s_conns[i] );
+
+    for( int i = 0; i < kConnCount;  ++i )
+    {
+        if( i % 2 )
+            CHECK( g_active_conns.FindByConsumingId( 0x1000 + i ) == &s_conns[i] );
+        else
+            CHECK( g_active_conns.FindByConsumingId( 0x1000 + i ) == NULL );
+    }
+
+    // A duplicated id resolves to the newest, then to the older once removed.
+    prepare( &s_conns[0], 0x1001, 0 );
+    g_active_conns.Insert( &s_conns[0] );
+
+    CHECK( g_active_conns.FindByConsumingId( 0x1001 ) == &s_conns[0] );
+
+    g_active_conns.Remove( &s_conns[0] );
+
+    CHECK( g_active_conns.FindByConsumingId( 0x1001 ) == &s_conns[1] );
+
+    // Only established connections are found.
+    s_conns[1].SetState( kConnStateTimedOut );
+
+    CHECK( g_active_conns.FindByConsumingId( 0x1001 ) == NULL );
+
+    remove_all();
+
+    for( int i = 0; i < kConnCount;  ++i )
+        CHECK( g_active_conns.FindByConsumingId( 0x1000 + i ) == NULL );
+
+    CHECK( g_active_conns.begin() == g_active_conns.end() );
+}
+
+
+// ---- Application callbacks the eip library expects an adapter app to provide ----
+// This test is not a running adapter, so they are inert stubs that merely satisfy the
+// linker.  None of them are reached by the tests above.
+EipStatus AfterAssemblyDataReceived( AssemblyInstance*, OpMode, int ) { return kEipStatusOk; }
+bool      BeforeAssemblyDataSend( AssemblyInstance* )                 { return false; }
+void      NotifyIoConnectionEvent( CipConn*, IoConnectionEvent )      {}
+void      RunIdleChanged( uint32_t )                                  {}
+void      HandleApplication()                                         {}
+EipStatus ResetDevice()                                               { return kEipStatusOk; }
+EipStatus ResetDeviceToInitialConfiguration( bool )                   { return kEipStatusOk; }
+
+
+int main()
+{
+    test_heap_order();
+    test_due_only();
+    test_requeue();
+    test_remove_keeps_order();
+    test_cid_hash();
+
+    printf( "%s: %d checks, %d failure(s)\n",
+            g_fail ? "FAILED" : "PASSED", g_checks, g_fail );
+
+    return g_fail ? 1 : 0;
+}
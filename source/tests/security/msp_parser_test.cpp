@@ -0,0 +1,347 @@
+/*******************************************************************************
+ * Copyright (c) 2026, SoftPLC Corporation.
+ *
+ * Standalone, dependency-free regression test for the Multiple Service Packet
+ * parser, CipMessageRouterClass::multiple_service_packet_service().
+ *
+ * Background: the request data of a Multiple Service Packet is a count of
+ * services, a table of 16 bit offsets from the start of that count, then the
+ * services themselves (Vol1 A-4.10).  All of it comes off the wire, so the
+ * parser must reject a count of zero, a table running past the data, and any
+ * offset which points back into the table, past the end of the data, or
+ * before the offset of the service preceding it.  A Multiple Service Packet
+ * may not be nested in another, and when the replies do not all fit in the
+ * reply buffer the only reply is kCipErrorReplyDataTooLarge, never a truncated
+ * table.
+ *
+ * The embedded services used here are Get_Attribute_Single of the Identity
+ * object's vendor id, which succeeds, and the same of an unregistered class,
+ * which fails with kCipErrorPathDestinationUnknown.
+ *
+ * Like its siblings it avoids the (unbuilt) CppUTest harness: it links only
+ * against the eip library and reports via the process exit code.
+ ******************************************************************************/
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <cipster_api.h>
+#include <cipmessagerouter.h>
+#include <byte_bufs.h>
+#include "../../src/enet_encap/cpf.h"
+
+
+static int g_checks = 0;
+static int g_fail   = 0;
+
+#define CHECK( cond )                                                       \
+    do {                                                                    \
+        ++g_checks;                                                         \
+        if( !(cond) ) {                                                     \
+            ++g_fail;                                                       \
+            printf( "  FAIL %s:%d   %s\n", __FILE__, __LINE__, #cond );     \
+        }                                                                   \
+    } while( 0 )
+
+
+// Get_Attribute_Single class 1, instance 1, attribute 1: the vendor id.
+static const uint8_t get_vendor[] = { 0x0e, 0x03, 0x20, 0x01, 0x24, 0x01, 0x30, 0x01 };
+
+// The same of class 0x99, which is not registered.
+static const uint8_t get_unknown[] = { 0x0e, 0x03, 0x20, 0x99, 0x24, 0x01, 0x30, 0x01 };
+
+// A Multiple Service Packet to the Message Router, with an empty one inside.
+static const uint8_t nested_msp[] = { 0x0a, 0x02, 0x20, 0x02, 0x24, 0x01, 0x00, 0x00 };
+
+enum { kVendorReplySize = 6 };     // reply service, reserved, status, ext size, UINT
+
+
+/// Builds the request data of a Multiple Service Packet.
+class Packet
+{
+public:
+    Packet& Service( const uint8_t* aBytes, int aCount )
+    {
+        services.push_back( std::vector<uint8_t>( aBytes, aBytes + aCount ) );
+        return *this;
+    }
+
+    /// Lays out count, offsets and services, with offsets as they should be.
+    std::vector<uint8_t>& Build()
+    {
+        std::vector<uint16_t> offsets;
+
+        unsigned at = 2 + 2 * services.size();
+
+        for( unsigned i = 0; i < services.size();  ++i )
+        {
+            offsets.push_back( at );
+            at += services[i].size();
+        }
+
+        return Build( offsets );
+    }
+
+    /// Lays out count, @a aOffsets and services, for offsets to be wrong.
+    std::vector<uint8_t>& Build( const std::vector<uint16_t>& aOffsets )
+    {
+        bytes.clear();
+        put16( services.size() );
+
+        for( unsigned i = 0; i < aOffsets.size();  ++i )
+            put16( aOffsets[i] );
+
+        for( unsigned i = 0; i < services.size();  ++i )
+            bytes.insert( bytes.end(), services[i].begin(), services[i].end() );
+
+        return bytes;
+    }
+
+private:
+    void put16( unsigned aValue )
+    {
+        bytes.push_back( uint8_t( aValue ) );
+        bytes.push_back( uint8_t( aValue >> 8 ) );
+    }
+
+    std::vector< std::vector<uint8_t> > services;
+    std::vector<uint8_t>                bytes;
+};
+
+
+static uint16_t get16( const uint8_t* p )
+{
+    return uint16_t( p[0] | ( p[1] << 8 ) );
+}
+
+
+static uint8_t  s_reply[CIPSTER_MESSAGE_DATA_REPLY_BUFFER];
+
+
+/// Performs the Multiple Service Packet in @a aData, replying into the first
+/// @a aReplyCapacity bytes of s_reply.
+static CipError perform( const std::vector<uint8_t>& aData, int* aReplySize,
+        size_t aReplyCapacity = sizeof s_reply )
+{
+    Cpf cpf( kCpfIdNullAddress, kCpfIdUnconnectedDataItem );
+
+    CipMessageRouterRequest     request;
+    CipMessageRouterResponse    response( &cpf, BufWriter( s_reply, aReplyCapacity ) );
+
+    request.SetService( kMultipleServicePacket );
+    request.SetData( BufReader( aData.data(), aData.size() ) );
+
+    memset( s_reply, 0xee, sizeof s_reply );
+
+    EipStatus status = CipMessageRouterClass::multiple_service_packet_service(
+                        NULL, &request, &response );
+
+    CHECK( status == kEipStatusOkSend );
+
+    *aReplySize = response.WrittenSize();
+
+    return response.GenStatus();
+}
+
+
+static void test_good_packet()
+{
+    printf( "MSP: two good services reply with both, in order\n" );
+
+    std::vector<uint8_t> data = Packet()
+        .Service( get_vendor, sizeof get_vendor )
+        .Service( get_vendor, sizeof get_vendor )
+        .Build();
+
+    int         size;
+    CipError    result = perform( data, &size );
+
+    CHECK( result == kCipErrorSuccess );
+    CHECK( size == 6 + 2 * kVendorReplySize );
+    CHECK( get16( s_reply ) == 2 );
+    CHECK( get16( s_reply + 2 ) == 6 );
+    CHECK( get16( s_reply + 4 ) == 6 + kVendorReplySize );
+    CHECK( s_reply[6] == 0x8e && s_reply[8] == 0 );
+    CHECK( get16( s_reply + 10 ) == CIPSTER_DEVICE_VENDOR_ID );
+    CHECK( s_reply[12] == 0x8e && s_reply[14] == 0 );
+}
+
+
+static void test_count_and_table()
+{
+    printf( "MSP: a count of zero or a table past the data is rejected\n" );
+
+    int size;
+
+    std::vector<uint8_t> zero( 2, 0 );
+    CHECK( perform( zero, &size ) == kCipErrorNotEnoughData );
+
+    std::vector<uint8_t> one_byte( 1, 1 );
+    CHECK( perform( one_byte, &size ) == kCipErrorNotEnoughData );
+
+    // A count of 3 with room for only one offset after it.
+    std::vector<uint8_t> short_table;
+    short_table.push_back( 3 );
+    short_table.push_back( 0 );
+    short_table.push_back( 4 );
+    short_table.push_back( 0 );
+    CHECK( perform( short_table, &size ) == kCipErrorNotEnoughData );
+}
+
+
+static void test_bad_offsets()
+{
+    printf( "MSP: offsets into the table, backwards or past the end are rejected\n" );
+
+    Packet  two;
+    two.Service( get_vendor, sizeof get_vendor )
+       .Service( get_vendor, sizeof get_vendor );
+
+    int     end = 6 + 2 * sizeof get_vendor;
+    int     size;
+
+    std::vector<uint16_t> offsets( 2 );
+
+    // The first points into the offset table.
+    offsets[0] = 4;
+    offsets[1] = 14;
+    CHECK( perform( two.Build( offsets ), &size ) == kCipErrorInvalidParameter );
+
+    // The second points back before the first.
+    offsets[0] = 14;
+    offsets[1] = 6;
+    CHECK( perform( two.Build( offsets ), &size ) == kCipErrorInvalidParameter );
+
+    // The second is the same as the first, leaving the first no bytes.
+    offsets[0] = 6;
+    offsets[1] = 6;
+    CHECK( perform( two.Build( offsets ), &size ) == kCipErrorInvalidParameter );
+
+    // The second points past the end of the data.
+    offsets[0] = 6;
+    offsets[1] = end + 100;
+    CHECK( perform( two.Build( offsets ), &size ) == kCipErrorInvalidParameter );
+
+    // The second points at the very end, leaving it no bytes.
+    offsets[0] = 6;
+    offsets[1] = end;
+    CHECK( perform( two.Build( offsets ), &size ) == kCipErrorInvalidParameter );
+
+    // The last one points past the end of the data.
+    Packet  one;
+    one.Service( get_vendor, sizeof get_vendor );
+
+    std::vector<uint16_t> past( 1, 0x4000 );
+    CHECK( perform( one.Build( past ), &size ) == kCipErrorInvalidParameter );
+}
+
+
+static void test_nested()
+{
+    printf( "MSP: a nested Multiple Service Packet fails alone\n" );
+
+    std::vector<uint8_t> data = Packet()
+        .Service( nested_msp, sizeof nested_msp )
+        .Service( get_vendor, sizeof get_vendor )
+        .Build();
+
+    int         size;
+    CipError    result = perform( data, &size );
+
+    CHECK( result == kCipErrorEmbeddedServiceError );
+    CHECK( get16( s_reply ) == 2 );
+
+    unsigned first  = get16( s_reply + 2 );
+    unsigned second = get16( s_reply + 4 );
+
+    CHECK( first == 6 );
+    CHECK( s_reply[first] == 0x8a );
+    CHECK( s_reply[first + 2] == kCipErrorServiceNotSupported );
+
+    // The service after it is still performed.
+    CHECK( second < unsigned( size ) );
+    CHECK( s_reply[second] == 0x8e && s_reply[second + 2] == 0 );
+    CHECK( size == int( second ) + kVendorReplySize );
+}
+
+
+static void test_embedded_error()
+{
+    printf( "MSP: a failing service gives kCipErrorEmbeddedServiceError\n" );
+
+    std::vector<uint8_t> data = Packet()
+        .Service( get_vendor, sizeof get_vendor )
+        .Service( get_unknown, sizeof get_unknown )
+        .Build();
+
+    int         size;
+    CipError    result = perform( data, &size );
+
+    CHECK( result == kCipErrorEmbeddedServiceError );
+    CHECK( get16( s_reply ) == 2 );
+
+    unsigned second = get16( s_reply + 4 );
+
+    CHECK( s_reply[6] == 0x8e && s_reply[8] == 0 );
+    CHECK( s_reply[second] == 0x8e );
+    CHECK( s_reply[second + 2] == kCipErrorPathDestinationUnknown );
+}
+
+
+static void test_reply_too_large()
+{
+    printf( "MSP: replies which do not fit give only kCipErrorReplyDataTooLarge\n" );
+
+    std::vector<uint8_t> data = Packet()
+        .Service( get_vendor, sizeof get_vendor )
+        .Service( get_vendor, sizeof get_vendor )
+        .Build();
+
+    int size;
+
+    // Room for the table and the first reply, not the second.
+    CHECK( perform( data, &size, 6 + kVendorReplySize + 1 ) == kCipErrorReplyDataTooLarge );
+    CHECK( size == 0 );
+
+    // Not even room for the table.
+    CHECK( perform( data, &size, 4 ) == kCipErrorReplyDataTooLarge );
+    CHECK( size == 0 );
+
+    // Exactly enough.
+    CHECK( perform( data, &size, 6 + 2 * kVendorReplySize ) == kCipErrorSuccess );
+    CHECK( size == 6 + 2 * kVendorReplySize );
+}
+
+
+// ---- Application callbacks the eip library expects an adapter app to provide ----
+// This test is not a running adapter, so they are inert stubs that merely satisfy the
+// linker.  None of them are reached by the tests above.
+EipStatus AfterAssemblyDataReceived( AssemblyInstance*, OpMode, int ) { return kEipStatusOk; }
+bool      BeforeAssemblyDataSend( AssemblyInstance* )                 { return false; }
+void      NotifyIoConnectionEvent( CipConn*, IoConnectionEvent )      {}
+void      RunIdleChanged( uint32_t )                                  {}
+void      HandleApplication()                                         {}
+EipStatus ResetDevice()                                               { return kEipStatusOk; }
+EipStatus ResetDeviceToInitialConfiguration( bool )                   { return kEipStatusOk; }
+
+
+int main()
+{
+    CipStackInit( 1 );
+
+    test_good_packet();
+    test_count_and_table();
+    test_bad_offsets();
+    test_nested();
+    test_embedded_error();
+    test_reply_too_large();
+
+    ShutdownCipStack();
+
+    printf( "%s: %d checks, %d failure(s)\n",
+            g_fail ? "FAILED" : "PASSED", g_checks, g_fail );
+
+    return g_fail ? 1 : 0;
+}
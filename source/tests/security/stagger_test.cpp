@@ -0,0 +1,219 @@
+/*******************************************************************************
+ * Copyright (c) 2026, SoftPLC Corporation.
+ *
+ * Standalone, dependency-free regression test for the staggering of cyclic
+ * productions, CipConnMgrClass::StaggerProduction() and ProductionSlotLoad().
+ *
+ * Background: cyclic connections of the same RPI opened together all produce
+ * in the same ManageConnections() pass, a burst which grows with their count.
+ * StaggerProduction() gives a connection about to be activated the first slot
+ * of CIPSTER_RPI_RESOLUTION_USECS within its RPI which collides least with the
+ * productions already scheduled, and ProductionSlotLoad() reports the result.
+ *
+ * This test pins down that:
+ *   1. without staggering, N connections of one RPI all land in slot 0;
+ *   2. with it, as many connections as the RPI has slots land one per slot,
+ *      and only then do they double up;
+ *   3. a harmonic mix of RPIs which exactly fills the slots is packed with no
+ *      slot used twice;
+ *   4. a connection is never staggered past its own RPI.
+ *
+ * A connection is made a cyclic producer by giving it an RPI and a non-NULL
+ * producing socket, which is never used since nothing is sent.
+ *
+ * Like its siblings it avoids the (unbuilt) CppUTest harness: it links only
+ * against the eip library and reports via the process exit code.
+ ******************************************************************************/
+
+#include <cstdio>
+#include <cstdint>
+#include <vector>
+
+#include <cipster_api.h>
+#include <cipconnection.h>
+#include <cipconnectionmanager.h>
+
+
+static int g_checks = 0;
+static int g_fail   = 0;
+
+#define CHECK( cond )                                                       \
+    do {                                                                    \
+        ++g_checks;                                                         \
+        if( !(cond) ) {                                                     \
+            ++g_fail;                                                       \
+            printf( "  FAIL %s:%d   %s\n", __FILE__, __LINE__, #cond );     \
+        }                                                                   \
+    } while( 0 )
+
+
+// Exposes the protected producing_socket, which ProducesOnTimer() requires.
+class TestConn : public CipConn
+{
+public:
+    void SetProducingSocket( UdpSocket* aSocket )   { producing_socket = aSocket; }
+};
+
+
+enum { kConnCount = 16 };
+
+static TestConn     s_conns[kConnCount];
+static int          s_fake_socket;          // only its address is used
+
+static const uint32_t kSlot = CIPSTER_RPI_RESOLUTION_USECS;
+
+
+/// Readies connection @a i as a cyclic producer of RPI @a aSlots slots and
+/// activates it, staggered if @a aStagger.
+static TestConn* open_conn( int i, unsigned aSlots, bool aStagger )
+{
+    TestConn* c = &s_conns[i];
+
+    c->Transport().Set( 0 );        // client, cyclic, class 0
+    c->SetProducingRPI( aSlots * kSlot );
+    c->SetExpectedPacketRateUSecs( aSlots * kSlot );
+    c->SetConsumingConnectionId( 0x2000 + i );
+    c->SetProducingSocket( (UdpSocket*) &s_fake_socket );
+
+    if( aStagger )
+        CipConnMgrClass::StaggerProduction( c );
+    else
+        c->SetTransmissionTriggerTimerUSecs( 0 );
+
+    c->SetState( kConnStateEstablished );
+    CHECK( g_active_conns.Insert( c ) );
+
+    return c;
+}
+
+
+static void close_all()
+{
+    for( int i = 0; i < kConnCount;  ++i )
+    {
+        if( g_active_conns.Remove( &s_conns[i] ) )
+            s_conns[i].SetState( kConnStateNonExistent );
+    }
+}
+
+
+/// Return the slot, 0 being now, of the next production of @a aConn.
+static int slot_of( const CipConn* aConn )
+{
+    return ( aConn->TransmissionTriggerTimerUSecs() + kSlot / 2 ) / kSlot;
+}
+
+
+static void test_unstaggered()
+{
+    printf( "Stagger: unstaggered connections of one RPI all produce in slot 0\n" );
+
+    for( int i = 0; i < 8;  ++i )
+        open_conn( i, 8, false );
+
+    std::vector<int> load;
+
+    CHECK( CipConnMgrClass::ProductionSlotLoad( &load ) == 8 );
+    CHECK( load.size() == 8 );
+    CHECK( load[0] == 8 );
+
+    close_all();
+}
+
+
+static void test_one_rpi()
+{
+    printf( "Stagger: connections of one RPI take one slot each until all are used\n" );
+
+    std::vector<int>    load;
+    std::vector<bool>   used( 8, false );
+
+    for( int i = 0; i < 8;  ++i )
+    {
+        TestConn* c = open_conn( i, 8, true );
+
+        int s = slot_of( c );
+
+        CHECK( s >= 0 && s < 8 );
+        CHECK( !used[s] );
+        used[s] = true;
+
+        CHECK( CipConnMgrClass::ProductionSlotLoad( &load ) == 1 );
+    }
+
+    // The ninth must double up somewhere.
+    open_conn( 8, 8, true );
+
+    CHECK( CipConnMgrClass::ProductionSlotLoad( &load ) == 2 );
+
+    close_all();
+}
+
+
+static void test_harmonic_mix()
+{
+    printf( "Stagger: a harmonic mix of RPIs filling every slot is packed exactly\n" );
+
+    // 1/2 + 1/4 + 1/8 + 1/8 of the slots of the longest RPI.
+    open_conn( 0, 2, true );
+    open_conn( 1, 4, true );
+    open_conn( 2, 8, true );
+    open_conn( 3, 8, true );
+
+    std::vector<int> load;
+
+    CHECK( CipConnMgrClass::ProductionSlotLoad( &load ) == 1 );
+    CHECK( load.size() == 8 );
+
+    for( unsigned s = 0; s < load.size();  ++s )
+        CHECK( load[s] == 1 );
+
+    close_all();
+}
+
+
+static void test_within_rpi()
+{
+    printf( "Stagger: a connection is never staggered past its own RPI\n" );
+
+    // Fill the slots of an RPI of 3 with ones of RPI 6, then add one of 3.
+    for( int i = 0; i < 6;  ++i )
+        open_conn( i, 6, true );
+
+    TestConn* c = open_conn( 6, 3, true );
+
+    CHECK( slot_of( c ) < 3 );
+
+    // An RPI of more slots than are looked at.
+    TestConn* l = open_conn( 7, CipConnMgrClass::kMaxStaggerSlots * 2, true );
+
+    CHECK( slot_of( l ) < CipConnMgrClass::kMaxStaggerSlots );
+
+    close_all();
+}
+
+
+// ---- Application callbacks the eip library expects an adapter app to provide ----
+// This test is not a running adapter, so they are inert stubs that merely satisfy the
+// linker.  None of them are reached by the tests above.
+EipStatus AfterAssemblyDataReceived( AssemblyInstance*, OpMode, int ) { return kEipStatusOk; }
+bool      BeforeAssemblyDataSend( AssemblyInstance* )                 { return false; }
+void      NotifyIoConnectionEvent( CipConn*, IoConnectionEvent )      {}
+void      RunIdleChanged( uint32_t )                                  {}
+void      HandleApplication()                                         {}
+EipStatus ResetDevice()                                               { return kEipStatusOk; }
+EipStatus ResetDeviceToInitialConfiguration( bool )                   { return kEipStatusOk; }
+
+
+int main()
+{
+    test_unstaggered();
+    test_one_rpi();
+    test_harmonic_mix();
+    test_within_rpi();
+
+    printf( "%s: %d checks, %d failure(s)\n",
+            g_fail ? "FAILED" : "PASSED", g_checks, g_fail );
+
+    return g_fail ? 1 : 0;
+}
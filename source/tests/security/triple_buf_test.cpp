@@ -0,0 +1,290 @@
+/*******************************************************************************
+ * Copyright (c) 2026, SoftPLC Corporation.
+ *
+ * Standalone, dependency-free regression test for TripleBuf and the triple
+ * buffered AssemblyInstance built on it.
+ *
+ * Background: a triple buffered assembly is written by one thread and read by
+ * another without locks.  That is only safe while the writer's Back() is never
+ * the reader's Front(), whatever order Publish() and Acquire() come in, and
+ * while Acquire() only ever hands out complete, newer images.  Should either
+ * slip, the stack sends a torn frame or the application reads one.
+ *
+ * This test pins down that:
+ *   1. over every interleaving of Publish() and Acquire() up to a depth,
+ *      Back() and Front() are distinct, Acquire() reports a change exactly
+ *      when there is a newer image, and Front() is then the newest one;
+ *   2. with a writer and a reader thread hammering one TripleBuf, the reader
+ *      never sees a torn image nor one older than what it saw before;
+ *   3. AssemblyInstance::Refresh() shows the stack the newest published image,
+ *      at most once per tick, and never the one the application is filling.
+ *
+ * Like its siblings it avoids the (unbuilt) CppUTest harness: it links only
+ * against the eip library and reports via the process exit code.
+ ******************************************************************************/
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+
+#include <cipster_api.h>
+#include <cipassembly.h>
+#include <triple_buf.h>
+
+
+static int g_checks = 0;
+static int g_fail   = 0;
+
+#define CHECK( cond )                                                       \
+    do {                                                                    \
+        ++g_checks;                                                         \
+        if( !(cond) ) {                                                     \
+            ++g_fail;                                                       \
+            printf( "  FAIL %s:%d   %s\n", __FILE__, __LINE__, #cond );     \
+        }                                                                   \
+    } while( 0 )
+
+
+enum { kImageSize = 64 };
+
+
+static void fill( uint8_t* aImage, uint8_t aValue )
+{
+    memset( aImage, aValue, kImageSize );
+}
+
+
+/// Return the value every byte of @a aImage holds, or -1 if it is torn.
+static int whole( const uint8_t* aImage )
+{
+    for( int i = 1; i < kImageSize;  ++i )
+        if( aImage[i] != aImage[0] )
+            return -1;
+
+    return aImage[0];
+}
+
+
+/// Plays the sequence of operations in the low @a aDepth bits of @a aOps,
+/// a one bit being a Publish() and a zero bit an Acquire().
+static void play( unsigned aOps, int aDepth )
+{
+    uint8_t     init[kImageSize] = {};
+    TripleBuf   tb( init, kImageSize );
+
+    int newest = 0;     // value of the last image published
+    int seen   = 0;     // value of the reader's Front()
+
+    for( int i = 0; i < aDepth;  ++i )
+    {
+        if( aOps & ( 1 << i ) )
+        {
+            fill( tb.Back(), ++newest );
+            tb.Publish();
+
+            CHECK( whole( tb.Published() ) == newest );
+        }
+        else
+        {
+            bool changed = tb.Acquire();
+
+            CHECK( changed == ( seen != newest ) );
+
+            seen = whole( tb.Front() );
+
+            CHECK( seen == newest );
+        }
+
+        CHECK( tb.Back() != tb.Front() );
+        CHECK( tb.Back() != tb.Published() );
+    }
+}
+
+
+static void test_interleavings()
+{
+    printf( "TripleBuf: every interleaving keeps Back() off Front(), Acquire() newest\n" );
+
+    const int depth = 12;
+
+    for( unsigned ops = 0; ops < ( 1u << depth );  ++ops )
+        play( ops, depth );
+}
+
+
+/// Fill @a aImage with the count @a aValue followed by copies of its low byte.
+static void stamp( uint8_t* aImage, uint32_t aValue )
+{
+    memcpy( aImage, &aValue, sizeof aValue );
+    memset( aImage + sizeof aValue, uint8_t( aValue ), kImageSize - sizeof aValue );
+}
+
+
+/// Return the count stamped into @a aImage, or -1 if it is torn.
+static int64_t stamped( const uint8_t* aImage )
+{
+    uint32_t value;
+
+    memcpy( &value, aImage, sizeof value );
+
+    for( unsigned i = sizeof value; i < kImageSize;  ++i )
+        if( aImage[i] != uint8_t( value ) )
+            return -1;
+
+    return value;
+}
+
+
+static void test_two_threads()
+{
+    printf( "TripleBuf: a reader thread never sees a torn or older image\n" );
+
+    uint8_t     init[kImageSize] = {};
+    TripleBuf   tb( init, kImageSize );
+
+    const int   kLast = 200000;
+
+    std::atomic<bool>   done( false );
+
+    std::thread writer( [&]()
+        {
+            for( int n = 1; n <= kLast;  ++n )
+            {
+                stamp( tb.Back(), n );
+                tb.Publish();
+            }
+
+            done = true;
+        } );
+
+    int     torn = 0;
+    int     older = 0;
+    int     changes = 0;
+    int64_t last = 0;
+    bool    finished;
+
+    do
+    {
+        finished = done;
+
+        if( !tb.Acquire() )
+            continue;
+
+        ++changes;
+
+        int64_t value = stamped( tb.Front() );
+
+        if( value < 0 )
+            ++torn;
+        else if( value <= last )
+            ++older;
+        else
+            last = value;
+
+    } while( !finished );
+
+    writer.join();
+
+    // Whatever came after the last look is there now.
+    tb.Acquire();
+
+    CHECK( torn == 0 );
+    CHECK( older == 0 );
+    CHECK( changes > 0 );
+    CHECK( stamped( tb.Front() ) == kLast );
+}
+
+
+static void test_assembly()
+{
+    printf( "TripleBuf: a produced assembly shows the stack only published images\n" );
+
+    static uint8_t  store[kImageSize];
+
+    fill( store, 0x11 );
+
+    AssemblyInstance    a( 100, ByteBuf( store, sizeof store ) );
+
+    a.AddConnectionPointRole( AssemblyInstance::kRoleProduced );
+    a.SetTripleBuffered();
+
+    CHECK( a.IsTripleBuffered() );
+    CHECK( a.Buffer().data() != store );
+    CHECK( a.Buffer().size() == kImageSize );
+    CHECK( whole( a.Buffer().data() ) == 0x11 );
+
+    // Publishing before the stack's first Refresh() must not hand the
+    // stack's image to the application to fill next.
+    fill( a.ImageToWrite(), 0x22 );
+    a.PublishImage();
+
+    CHECK( a.Buffer().data() != a.ImageToWrite() );
+
+    fill( a.ImageToWrite(), 0x99 );
+
+    CHECK( whole( a.Buffer().data() ) == 0x11 );
+
+    // Published images show from the next Refresh() on, filled ones do not.
+    g_current_usecs = 1000;
+    a.Refresh();
+
+    CHECK( whole( a.Buffer().data() ) == 0x22 );
+    CHECK( a.Buffer().data() != a.ImageToWrite() );
+
+    // At most once per tick.
+    a.PublishImage();
+    a.Refresh();
+
+    CHECK( whole( a.Buffer().data() ) == 0x22 );
+
+    g_current_usecs += 1000;
+    a.Refresh();
+
+    CHECK( whole( a.Buffer().data() ) == 0x99 );
+    CHECK( a.Buffer().data() != a.ImageToWrite() );
+
+    // Of several published within a tick the stack gets the last.
+    for( int n = 0x30; n < 0x35;  ++n )
+    {
+        fill( a.ImageToWrite(), n );
+        a.PublishImage();
+
+        CHECK( a.Buffer().data() != a.ImageToWrite() );
+        CHECK( whole( a.Buffer().data() ) == 0x99 );
+    }
+
+    g_current_usecs += 1000;
+    a.Refresh();
+
+    CHECK( whole( a.Buffer().data() ) == 0x34 );
+    CHECK( a.Buffer().data() != a.ImageToWrite() );
+
+    // The buffer given at creation is no longer used.
+    CHECK( whole( store ) == 0x11 );
+}
+
+
+// ---- Application callbacks the eip library expects an adapter app to provide ----
+// This test is not a running adapter, so they are inert stubs that merely satisfy the
+// linker.  None of them are reached by the tests above.
+EipStatus AfterAssemblyDataReceived( AssemblyInstance*, OpMode, int ) { return kEipStatusOk; }
+bool      BeforeAssemblyDataSend( AssemblyInstance* )                 { return false; }
+void      NotifyIoConnectionEvent( CipConn*, IoConnectionEvent )      {}
+void      RunIdleChanged( uint32_t )                                  {}
+void      HandleApplication()                                         {}
+EipStatus ResetDevice()                                               { return kEipStatusOk; }
+EipStatus ResetDeviceToInitialConfiguration( bool )                   { return kEipStatusOk; }
+
+
+int main()
+{
+    test_interleavings();
+    test_two_threads();
+    test_assembly();
+
+    printf( "%s: %d checks, %d failure(s)\n",
+            g_fail ? "FAILED" : "PASSED", g_checks, g_fail );
+
+    return g_fail ? 1 : 0;
+}